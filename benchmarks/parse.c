@@ -0,0 +1,81 @@
+/*Parse throughput of the command line parser (source/parser.h).
+Builds a corpus of large command lines mixing quoting, pipelines, sequences,
+conditionals and redirections, parses every line many times the way the shell
+does (arenaReset() then parseCommandLine()) and prints one JSON object.
+Compile: gcc -O2 -Wall -o parse parse.c (or make benchmarks)
+Run:     ./parse [lines] [rounds]*/
+#define _GNU_SOURCE
+/*declarations.h defines the state of the whole shell, most of which only
+the rest of the shell uses; that alone is not worth a warning here*/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "../source/declarations.h"
+#pragma GCC diagnostic pop
+#include "../source/parser.h"
+
+int readLine()//only readHereDocuments() reads input, and it is not run here
+{
+        return EOF;
+}
+
+static const char *pieces[] = {
+        "echo \"hello   world\" 'single $quoted' plain\\ word",
+        "grep -v \"^#\" /etc/passwd | cut -d: -f1 | sort | uniq -c",
+        "make -j8 all > build.log && echo built || echo failed",
+        "cat <<< 'a here string' | tr a-z A-Z",
+        "bg out /tmp/out.txt find / -name \"*.c\"",
+        "time sleep 0",
+        "cd /tmp; ls -la; cd -",
+        "printf '%s\\n' \"a \\\"quoted\\\" word\"",
+        NULL
+};
+
+int main(int argc, char **argv)
+{
+        int numLines = argc > 1 ? atoi(argv[1]) : 1000;
+        int rounds = argc > 2 ? atoi(argv[2]) : 200;
+        char **lines = malloc(numLines * sizeof(char*));
+        size_t totalBytes = 0;
+        long totalPipelines = 0;
+
+        /*Every line joins 8 to 64 pieces with ; && and ||*/
+        srand(1);
+        for (int i = 0; i < numLines; i++) {
+                int numPieces = 8 + rand() % 57;
+                size_t capacity = 4096, length = 0;
+                lines[i] = malloc(capacity);
+                for (int j = 0; j < numPieces; j++) {
+                        const char *piece = pieces[rand() % 8];
+                        const char *separator = j == 0 ? "" :
+                                                (const char*[]) { " ; ", " && ", " || " }[rand() % 3];
+                        while (length + strlen(piece) + 8 > capacity)
+                                lines[i] = realloc(lines[i], capacity *= 2);
+                        length += sprintf(lines[i] + length, "%s%s", separator, piece);
+                }
+                totalBytes += length;
+        }
+
+        /*The lexer only reads the line, so it can be parsed again as is*/
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        for (int round = 0; round < rounds; round++) {
+                for (int i = 0; i < numLines; i++) {
+                        arenaReset();
+                        for (t_pipeline *pipeline = parseCommandLine(lines[i]);
+                             pipeline != NULL; pipeline = pipeline->next)
+                                totalPipelines++;
+                }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        double seconds = (finished.tv_sec - started.tv_sec)
+                         + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+        double megabytes = totalBytes * (double) rounds / seconds / 1e6;
+        printf("{\"benchmark\": \"parse\", \"unit\": \"MB/s\", \"better\": \"higher\", "
+               "\"value\": %.2f, \"lines\": %d, \"rounds\": %d, "
+               "\"bytes\": %zu, \"pipelines\": %ld, \"seconds\": %.6f, "
+               "\"mb_per_second\": %.2f, \"lines_per_second\": %.0f}\n",
+               megabytes, numLines, rounds, totalBytes * rounds, totalPipelines,
+               seconds, megabytes, numLines * (double) rounds / seconds);
+        return 0;
+}
@@ -0,0 +1,570 @@
+/*Benchmarks of the whole shell, driven through a pseudo terminal the way a
+user drives it: the keys go in through the master side and the prompt coming
+back out marks the end of each command. Prints one JSON object per benchmark,
+each with a "value" and whether "better" is "lower" or "higher", so the output
+of two builds can be held against each other with --compare.
+  startup          first prompt of an interactive shell, and msh -c true
+  exec_latency     from the Enter key to the command running
+  bg_fanout        jobs per second for a line of "true &" ended by wait
+  launch_interval  per launch of a script starting 10000 "true &" jobs: the
+                   time between two launches, from the shell's event log
+  launch_call      the time posix_spawn() or fork() took in those launches
+  spawn_rate       the same, with the shell grown to about 100 MB, once
+                   launching with fork() (MSH_LAUNCH=fork), once with spawn
+  wait_cpu         CPU the shell uses while a foreground job sleeps
+  pipeline         MB per second of a 1 GB file through cat < file | wc -c
+Nothing is read from the network, and the shell gets a HOME of its own so its
+history file is left alone.
+Compile: gcc -O2 -Wall -o shell shell.c -lutil (or make benchmarks)
+Run:     ./shell path/to/msh [rounds]
+         ./shell --compare old.json new.json [percent]*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROMPT_MARK "<msh-bench>$ "
+#define FANOUT_JOBS 100
+#define SCRIPT_JOBS 10000
+#define BALLAST_BYTES (24L << 20)//the shell ends up holding about four times that
+#define PIPELINE_BYTES (1L << 30)
+#define SLEEP_SECONDS 2
+#define TIMEOUT_MS 60000
+
+static char *shellPath;
+static char *selfPath;
+static char homeDirectory[] = "/tmp/msh-bench-XXXXXX";
+static int terminal = -1;//master side of the shell's pseudo terminal
+static pid_t shellPid;
+static const char *launcher;//MSH_LAUNCH of the shells started, NULL for the default
+static char output[1 << 16];//what the shell wrote and was not looked at yet
+static size_t outputLength;
+
+static long long now()//nanoseconds, CLOCK_MONOTONIC
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+        double x = *(const double*) a, y = *(const double*) b;
+        return (x > y) - (x < y);
+}
+
+static double percentile(double *values, int count, int percent)//sorts values
+{
+        qsort(values, count, sizeof(double), compareDoubles);
+        return values[(count - 1) * percent / 100];
+}
+
+static void report(const char *name, const char *unit, const char *better,
+                   double *values, int count, const char *extra)
+/*the median is the value; extra holds more JSON fields, or is ""*/
+{
+        double median = percentile(values, count, 50);
+        printf("{\"benchmark\": \"%s\", \"unit\": \"%s\", \"better\": \"%s\", "
+               "\"value\": %.3f, \"min\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+               "\"max\": %.3f, \"runs\": %d%s}\n", name, unit, better, median, values[0],
+               percentile(values, count, 90), percentile(values, count, 99),
+               values[count - 1], count, extra);
+        fflush(stdout);
+}
+
+static void fail(const char *what)
+{
+        fprintf(stderr, "shell: %s\n", what);
+        if (shellPid > 0)
+                kill(shellPid, SIGKILL);
+        exit(EXIT_FAILURE);
+}
+
+static void readMore(long long deadline)//appends what the shell wrote next to output
+{
+        while (1) {
+                struct pollfd readable = { .fd = terminal, .events = POLLIN };
+                int left = (deadline - now()) / 1000000;
+                if (left <= 0 || poll(&readable, 1, left) == 0)
+                        fail("timed out waiting for the shell");
+                ssize_t count = read(terminal, output + outputLength,
+                                     sizeof(output) - outputLength);
+                if (count == -1 && errno == EINTR)
+                        continue;
+                if (count <= 0)
+                        fail("the shell went away");
+                outputLength += count;
+                return;
+        }
+}
+
+static void consume(size_t length)
+{
+        memmove(output, output + length, outputLength - length);
+        outputLength -= length;
+}
+
+static void waitFor(const char *text)
+/*reads what the shell writes until text shows up, and drops everything up to
+and including it*/
+{
+        long long deadline = now() + TIMEOUT_MS * 1000000LL;
+        size_t textLength = strlen(text);
+
+        while (1) {
+                char *found = memmem(output, outputLength, text, textLength);
+                if (found != NULL) {
+                        consume(found - output + textLength);
+                        return;
+                }
+                if (outputLength > textLength)//keep only what could start a match
+                        consume(outputLength - textLength);
+                readMore(deadline);
+        }
+}
+
+static long long readNumber()//the digits the shell writes next
+{
+        long long deadline = now() + TIMEOUT_MS * 1000000LL;
+        size_t length = 0;
+
+        while (length == outputLength || (output[length] >= '0' && output[length] <= '9')) {
+                if (length == outputLength)
+                        readMore(deadline);
+                else
+                        length++;
+        }
+        long long number = atoll(output);
+        consume(length);
+        return number;
+}
+
+static void type(const char *text)
+{
+        for (size_t done = 0, length = strlen(text); done < length; ) {
+                ssize_t count = write(terminal, text + done, length - done);
+                if (count == -1 && errno != EINTR)
+                        fail("cannot write to the terminal");
+                if (count > 0)
+                        done += count;
+        }
+}
+
+static long long enter(const char *line)
+/*types line, waits for the editor to have shown it, then presses Enter and
+waits for the next prompt. Returns when Enter was pressed. The editor never
+writes a newline before Enter, so the prompt after the first one is the next*/
+{
+        const char *tail = line + (strlen(line) > 8 ? strlen(line) - 8 : 0);
+        type(line);
+        waitFor(tail);
+        long long pressed = now();
+        type("\r");
+        waitFor("\n");
+        waitFor(PROMPT_MARK);
+        return pressed;
+}
+
+static void startShell()
+{
+        struct winsize size = { .ws_row = 50, .ws_col = 200 };
+        shellPid = forkpty(&terminal, NULL, NULL, &size);
+        if (shellPid == -1)
+                fail("forkpty failed");
+        if (shellPid == 0) {
+                setenv("HOME", homeDirectory, 1);
+                setenv("MSH_PROMPT", PROMPT_MARK, 1);
+                setenv("TERM", "dumb", 1);
+                unsetenv("MSH_EVENT_LOG");
+                unsetenv("MSH_METRICS_SOCKET");
+                if (launcher != NULL)
+                        setenv("MSH_LAUNCH", launcher, 1);
+                else
+                        unsetenv("MSH_LAUNCH");
+                execl(shellPath, shellPath, (char*) NULL);
+                _exit(127);
+        }
+        outputLength = 0;
+}
+
+static void stopShell()
+{
+        type("exit\r");
+        if (waitpid(shellPid, NULL, 0) == -1)
+                fail("lost the shell");
+        close(terminal);
+        shellPid = 0;
+}
+
+static long long shellCpuTime()//nanoseconds the shell has run
+{
+        char path[64];
+        long long running = 0;
+        unsigned long userTicks, systemTicks;
+
+        snprintf(path, sizeof(path), "/proc/%d/schedstat", shellPid);
+        FILE *file = fopen(path, "r");
+        if (file != NULL) {
+                int found = fscanf(file, "%lld", &running);
+                fclose(file);
+                if (found == 1)
+                        return running;
+        }
+        snprintf(path, sizeof(path), "/proc/%d/stat", shellPid);
+        if ((file = fopen(path, "r")) == NULL)
+                fail("cannot read the shell's CPU time");
+        /*the name in parentheses may hold spaces, the fields after it do not*/
+        int found = fscanf(file, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u "
+                                 "%*u %*u %lu %lu", &userTicks, &systemTicks);
+        fclose(file);
+        if (found != 2)
+                fail("cannot read the shell's CPU time");
+        return (userTicks + systemTicks) * (1000000000LL / sysconf(_SC_CLK_TCK));
+}
+
+static void benchmarkStartup(int rounds)
+{
+        double interactive[rounds], batch[rounds];
+
+        for (int round = 0; round < rounds; round++) {
+                long long started = now();
+                startShell();
+                waitFor(PROMPT_MARK);
+                interactive[round] = (now() - started) / 1e6;
+                stopShell();
+        }
+        report("startup_interactive", "ms", "lower", interactive, rounds, "");
+
+        for (int round = 0; round < rounds; round++) {
+                long long started = now();
+                pid_t pid = fork();
+                if (pid == 0) {
+                        int nothing = open("/dev/null", O_RDWR);
+                        dup2(nothing, STDIN_FILENO);
+                        execl(shellPath, shellPath, "-c", "true", (char*) NULL);
+                        _exit(127);
+                }
+                int status;
+                if (pid == -1 || waitpid(pid, &status, 0) == -1 || status != 0)
+                        fail("msh -c true failed");
+                batch[round] = (now() - started) / 1e6;
+        }
+        report("startup_batch", "ms", "lower", batch, rounds, "");
+}
+
+static void benchmarkLatency(int rounds)
+/*the command prints the time it started running, so the latency takes in the
+editor, parsing, the job table and the exec, but not waiting for the prompt*/
+{
+        double latency[rounds];
+        char line[4096];
+
+        snprintf(line, sizeof(line), "%s --stamp", selfPath);
+        startShell();
+        waitFor(PROMPT_MARK);
+        for (int round = 0; round < rounds; round++) {
+                const char *tail = line + strlen(line) - 8;
+                type(line);
+                waitFor(tail);
+                long long pressed = now();
+                type("\r");
+                waitFor("STAMP ");
+                latency[round] = (readNumber() - pressed) / 1e3;
+                waitFor(PROMPT_MARK);
+        }
+        stopShell();
+        report("exec_latency", "us", "lower", latency, rounds, "");
+}
+
+static void benchmarkFanout(int rounds)
+{
+        double rate[rounds];
+        char line[FANOUT_JOBS * 8 + 16];
+        size_t length = 0;
+
+        for (int i = 0; i < FANOUT_JOBS; i++)
+                length += sprintf(line + length, "true & ");
+        sprintf(line + length, "wait");
+        startShell();
+        waitFor(PROMPT_MARK);
+        for (int round = 0; round < rounds; round++) {
+                long long pressed = enter(line);
+                rate[round] = FANOUT_JOBS / ((now() - pressed) / 1e9);
+        }
+        stopShell();
+        report("bg_fanout", "jobs/s", "higher", rate, rounds, "");
+}
+
+static void benchmarkLaunches()
+/*the script runs without a terminal, like the batch jobs it stands for. Its
+launch events are in order, so the gaps between their times are what each
+launch cost the shell, parsing and the job table included*/
+{
+        char script[sizeof(homeDirectory) + 16], log[sizeof(homeDirectory) + 16];
+        char line[1024];
+        double *interval = malloc(SCRIPT_JOBS * sizeof(double));
+        double *call = malloc(SCRIPT_JOBS * sizeof(double));
+        int numLaunches = 0;
+        double previous = 0;
+
+        snprintf(script, sizeof(script), "%s/launch.msh", homeDirectory);
+        snprintf(log, sizeof(log), "%s/events.log", homeDirectory);
+        FILE *file = fopen(script, "w");
+        if (file == NULL)
+                fail("cannot write the launch script");
+        for (int i = 0; i < SCRIPT_JOBS; i++)
+                fputs("true &\n", file);
+        fputs("wait\n", file);
+        fclose(file);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+                int nothing = open("/dev/null", O_RDWR);
+                dup2(nothing, STDIN_FILENO);
+                dup2(nothing, STDOUT_FILENO);
+                setenv("MSH_EVENT_LOG", log, 1);
+                unsetenv("MSH_METRICS_SOCKET");
+                unsetenv("MSH_LAUNCH");
+                execl(shellPath, shellPath, script, (char*) NULL);
+                _exit(127);
+        }
+        int status;
+        if (pid == -1 || waitpid(pid, &status, 0) == -1 || status != 0)
+                fail("the launch script failed");
+
+        if ((file = fopen(log, "r")) == NULL)
+                fail("the shell wrote no event log");
+        while (fgets(line, sizeof(line), file) != NULL && numLaunches < SCRIPT_JOBS) {
+                long seconds, nanoseconds;
+                char *latency = strstr(line, "\"latency\": ");
+                if (strstr(line, "\"event\": \"launch\"") == NULL || latency == NULL
+                    || sscanf(line, "{\"time\": %ld.%ld", &seconds, &nanoseconds) != 2)
+                        continue;
+                double time = seconds * 1e6 + nanoseconds / 1e3;
+                if (numLaunches > 0)
+                        interval[numLaunches - 1] = time - previous;
+                call[numLaunches++] = atof(latency + 11) * 1e6;
+                previous = time;
+        }
+        fclose(file);
+        unlink(log);
+        unlink(script);
+        if (numLaunches < 2)
+                fail("no launches in the event log");
+        snprintf(line, sizeof(line), ", \"launches\": %d", numLaunches);
+        report("launch_interval", "us", "lower", interval, numLaunches - 1, line);
+        report("launch_call", "us", "lower", call, numLaunches, line);
+        free(interval);
+        free(call);
+}
+
+static long shellMemory()//kB the shell has resident
+{
+        char path[64], line[256];
+        long resident = 0;
+
+        snprintf(path, sizeof(path), "/proc/%d/status", shellPid);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+                fail("cannot read the shell's memory use");
+        while (fgets(line, sizeof(line), file) != NULL)
+                if (sscanf(line, "VmRSS: %ld", &resident) == 1)
+                        break;
+        fclose(file);
+        return resident;
+}
+
+static void benchmarkSpawnRate(int rounds)
+/*fork() copies the page tables of the shell, so it costs more the larger the
+shell is; posix_spawn() does not. The shell is grown by a command
+substitution: its output buffer, the copies the word goes through on
+expansion, and the variable*/
+{
+        static const char *launchers[] = { "fork", NULL };
+        double rate[rounds];
+        char line[FANOUT_JOBS * 8 + 16], ballast[128], name[32], extra[64];
+        size_t length = 0;
+
+        for (int i = 0; i < FANOUT_JOBS; i++)
+                length += sprintf(line + length, "true & ");
+        sprintf(line + length, "wait");
+        snprintf(ballast, sizeof(ballast), "BALLAST=$(head -c %ld /dev/zero | tr '\\0' x)",
+                 BALLAST_BYTES);
+        for (int i = 0; i < 2; i++) {
+                launcher = launchers[i];
+                startShell();
+                waitFor(PROMPT_MARK);
+                enter(ballast);
+                long resident = shellMemory();
+                for (int round = 0; round < rounds; round++) {
+                        long long pressed = enter(line);
+                        rate[round] = FANOUT_JOBS / ((now() - pressed) / 1e9);
+                }
+                stopShell();
+                snprintf(name, sizeof(name), "spawn_rate_%s", launcher ? launcher : "spawn");
+                snprintf(extra, sizeof(extra), ", \"rss_mb\": %.1f", resident / 1024.0);
+                report(name, "jobs/s", "higher", rate, rounds, extra);
+        }
+        launcher = NULL;
+}
+
+static void benchmarkWaitCpu(int rounds)
+/*a shell polling for its foreground job shows up here as whole seconds; one
+that sleeps in the kernel until the job is done uses next to nothing*/
+{
+        double used[rounds];
+        char line[64];
+
+        snprintf(line, sizeof(line), "sleep %d", SLEEP_SECONDS);
+        startShell();
+        waitFor(PROMPT_MARK);
+        for (int round = 0; round < rounds; round++) {
+                type(line);
+                waitFor(line + strlen(line) - 3);
+                type("\r");
+                waitFor("\n");
+                usleep(100000);//past the launch, which is exec_latency's
+                long long before = shellCpuTime();
+                waitFor(PROMPT_MARK);
+                used[round] = (shellCpuTime() - before) / 1e6;
+        }
+        stopShell();
+        report("wait_cpu", "ms", "lower", used, rounds, "");
+}
+
+static void benchmarkPipeline(int rounds)
+/*the file is opened by the shell and handed to cat with dup2(), so its data
+only moves inside the kernel, from the page cache through the pipe*/
+{
+        double rate[rounds];
+        char path[sizeof(homeDirectory) + 16], line[128];
+        static char block[1 << 20];
+
+        snprintf(path, sizeof(path), "%s/data", homeDirectory);
+        int file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        for (size_t i = 0; i < sizeof(block); i++)
+                block[i] = 'a' + i % 26;
+        for (long written = 0; file != -1 && written < PIPELINE_BYTES; written += sizeof(block))
+                if (write(file, block, sizeof(block)) != sizeof(block))
+                        fail("cannot write the pipeline's input file");
+        if (file == -1 || close(file) == -1)
+                fail("cannot write the pipeline's input file");
+
+        snprintf(line, sizeof(line), "cat < %s | wc -c", path);
+        startShell();
+        waitFor(PROMPT_MARK);
+        enter(line);//brings the file into the page cache
+        for (int round = 0; round < rounds; round++) {
+                long long pressed = enter(line);
+                rate[round] = PIPELINE_BYTES / ((now() - pressed) / 1e9) / 1e6;
+        }
+        stopShell();
+        unlink(path);
+        report("pipeline", "MB/s", "higher", rate, rounds, "");
+}
+
+static int readResults(const char *path, char names[][64], double *values,
+                       int *higher, int capacity)
+/*the benchmark, value and better fields of each JSON line in path*/
+{
+        FILE *file = fopen(path, "r");
+        char line[4096];
+        int count = 0;
+
+        if (file == NULL) {
+                perror(path);
+                exit(2);
+        }
+        while (count < capacity && fgets(line, sizeof(line), file) != NULL) {
+                char *name = strstr(line, "\"benchmark\": \"");
+                char *value = strstr(line, "\"value\": ");
+                char *better = strstr(line, "\"better\": \"");
+                if (name == NULL || value == NULL)
+                        continue;
+                sscanf(name + 14, "%63[^\"]", names[count]);
+                values[count] = atof(value + 9);
+                higher[count] = better != NULL && strncmp(better + 11, "higher", 6) == 0;
+                count++;
+        }
+        fclose(file);
+        return count;
+}
+
+static int compareResults(const char *oldPath, const char *newPath, double allowed)
+/*exits with 1 if any benchmark got worse by more than allowed percent*/
+{
+        char oldNames[64][64], newNames[64][64];
+        double oldValues[64], newValues[64];
+        int oldHigher[64], newHigher[64];
+        int regressions = 0;
+
+        int oldCount = readResults(oldPath, oldNames, oldValues, oldHigher, 64);
+        int newCount = readResults(newPath, newNames, newValues, newHigher, 64);
+        printf("%-22s %14s %14s %9s\n", "benchmark", "old", "new", "change");
+        for (int i = 0; i < newCount; i++) {
+                int j = 0;
+                while (j < oldCount && strcmp(oldNames[j], newNames[i]) != 0)
+                        j++;
+                if (j == oldCount) {
+                        printf("%-22s %14s %14.3f %9s\n", newNames[i], "-", newValues[i], "new");
+                        continue;
+                }
+                double change = oldValues[j] != 0
+                                ? (newValues[i] - oldValues[j]) / oldValues[j] * 100 : 0;
+                double worse = newHigher[i] ? -change : change;
+                int regressed = worse > allowed;
+                regressions += regressed;
+                printf("%-22s %14.3f %14.3f %+8.1f%%%s\n", newNames[i], oldValues[j],
+                       newValues[i], change, regressed ? "  REGRESSION" : "");
+        }
+        return regressions > 0;
+}
+
+int main(int argc, char **argv)
+{
+        if (argc == 2 && strcmp(argv[1], "--stamp") == 0) {
+                printf("STAMP %lld\n", now());
+                return 0;
+        }
+        if ((argc == 4 || argc == 5) && strcmp(argv[1], "--compare") == 0)
+                return compareResults(argv[2], argv[3], argc == 5 ? atof(argv[4]) : 10);
+        if (argc < 2 || argc > 3 || argv[1][0] == '-') {
+                fprintf(stderr, "usage: %s path/to/msh [rounds]\n"
+                                "       %s --compare old.json new.json [percent]\n",
+                        argv[0], argv[0]);
+                return 2;
+        }
+        int rounds = argc > 2 ? atoi(argv[2]) : 10;
+        if (rounds < 1)
+                rounds = 1;
+        shellPath = realpath(argv[1], NULL);
+        selfPath = realpath("/proc/self/exe", NULL);
+        if (shellPath == NULL || selfPath == NULL || access(shellPath, X_OK) != 0)
+                fail("cannot find the shell");
+        if (mkdtemp(homeDirectory) == NULL)
+                fail("cannot make a home directory");
+        signal(SIGPIPE, SIG_IGN);
+
+        benchmarkStartup(rounds);
+        benchmarkLatency(rounds * 10);
+        benchmarkFanout(rounds);
+        benchmarkLaunches();
+        benchmarkSpawnRate(rounds);
+        benchmarkWaitCpu(rounds < 3 ? rounds : 3);//each takes SLEEP_SECONDS
+        benchmarkPipeline(rounds);
+
+        char history[sizeof(homeDirectory) + 16];
+        snprintf(history, sizeof(history), "%s/.msh_history", homeDirectory);
+        unlink(history);
+        rmdir(homeDirectory);
+        return 0;
+}
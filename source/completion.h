@@ -0,0 +1,220 @@
+/*Candidates for Tab completion. Every directory is listed with large
+getdents64() reads and kept in memory sorted by name, together with the
+mtime it had, and is only listed again once that changes; a completion then
+costs one stat() per directory and a binary search. Command names come from
+a sorted index merging all the PATH directories, rebuilt only when one of
+them changed*/
+
+void collectCompletions(char *prefix, int isCommand)//fills completions, sorted and unique
+{
+        size_t prefixLength = strlen(prefix);
+        if (isCommand) {
+                for (int i = 0; builtInCommands[i] != NULL; i++)
+                        if (strncmp(builtInCommands[i], prefix, prefixLength) == 0)
+                                addCompletion(builtInCommands[i]);
+                refreshCommandIndex();
+                for (int i = findFirstName(commandNames, numCommandNames, sizeof(char*), prefix);
+                     i < numCommandNames && strncmp(commandNames[i], prefix, prefixLength) == 0;
+                     i++)
+                        addCompletion(commandNames[i]);
+        } else {
+                char *slash = strrchr(prefix, '/');
+                char *directory = slash ? strndup(prefix, slash - prefix + 1) : strdup(".");
+                char *namePrefix = slash ? slash + 1 : prefix;
+                size_t namePrefixLength = strlen(namePrefix);
+                t_directoryListing *listing = &fileListing;
+                if (listing->path == NULL || strcmp(listing->path, directory) != 0
+                    || listingChanged(listing)) {
+                        free(listing->path);
+                        listing->path = strdup(directory);
+                        scanDirectory(listing, FALSE);
+                }
+                for (int i = findFirstName(listing->entries, listing->numEntries,
+                                           sizeof(t_listedName), namePrefix);
+                     i < listing->numEntries
+                     && strncmp(listing->entries[i].name, namePrefix, namePrefixLength) == 0;
+                     i++) {
+                        t_listedName *entry = &listing->entries[i];
+                        if (entry->name[0] == '.' && namePrefix[0] != '.')
+                                continue;
+                        char *name = malloc(strlen(directory) + strlen(entry->name) + 2);
+                        sprintf(name, "%s%s%s", slash ? directory : "", entry->name,
+                                entry->isDirectory ? "/" : "");
+                        addCompletion(name);
+                        free(name);
+                }
+                free(directory);
+        }
+        if (numCompletions > 0)//completions is still NULL otherwise
+                qsort(completions, numCompletions, sizeof(char*), compareStrings);
+        int unique = 0;
+        for (int i = 0; i < numCompletions; i++) {
+                if (unique > 0 && strcmp(completions[unique - 1], completions[i]) == 0)
+                        free(completions[i]);
+                else
+                        completions[unique++] = completions[i];
+        }
+        numCompletions = unique;
+}
+
+void refreshCommandIndex()//relists the PATH directories that changed
+{
+        char *searchPath = lookupVariable("PATH");
+        int changed = FALSE;
+
+        if (searchPath == NULL)
+                searchPath = "/bin:/usr/bin";
+        if (indexedSearchPath == NULL || strcmp(indexedSearchPath, searchPath) != 0) {
+                for (int i = 0; i < numPathListings; i++)
+                        freeListing(&pathListings[i]);
+                free(indexedSearchPath);
+                indexedSearchPath = strdup(searchPath);
+                numPathListings = 0;
+                for (char *directory = searchPath; ; ) {
+                        char *end = strchr(directory, ':');
+                        size_t length = end ? (size_t) (end - directory) : strlen(directory);
+                        pathListings = realloc(pathListings, (numPathListings + 1)
+                                               * sizeof(t_directoryListing));
+                        t_directoryListing *listing = &pathListings[numPathListings++];
+                        memset(listing, 0, sizeof(t_directoryListing));
+                        listing->path = length ? strndup(directory, length) : strdup(".");
+                        if (end == NULL)
+                                break;
+                        directory = end + 1;
+                }
+                changed = TRUE;
+        }
+        for (int i = 0; i < numPathListings; i++) {
+                if (pathListings[i].scanned && !listingChanged(&pathListings[i]))
+                        continue;
+                scanDirectory(&pathListings[i], TRUE);
+                changed = TRUE;
+        }
+        if (!changed)
+                return;
+
+        numCommandNames = 0;
+        for (int i = 0; i < numPathListings; i++) {
+                for (int j = 0; j < pathListings[i].numEntries; j++) {
+                        if (numCommandNames == commandNamesCapacity) {
+                                commandNamesCapacity = commandNamesCapacity ?
+                                                       2 * commandNamesCapacity : 1024;
+                                commandNames = realloc(commandNames,
+                                                       commandNamesCapacity * sizeof(char*));
+                        }
+                        commandNames[numCommandNames++] = pathListings[i].entries[j].name;
+                }
+        }
+        if (numCommandNames > 0)
+                qsort(commandNames, numCommandNames, sizeof(char*), compareStrings);
+        int unique = 0;
+        for (int i = 0; i < numCommandNames; i++)
+                if (unique == 0 || strcmp(commandNames[unique - 1], commandNames[i]) != 0)
+                        commandNames[unique++] = commandNames[i];
+        numCommandNames = unique;
+}
+
+int listingChanged(t_directoryListing* listing)//compares the directory with when it was listed
+{
+        struct stat info;
+        if (stat(listing->path, &info) == -1)
+                return listing->numEntries > 0 || !listing->scanned;
+        return info.st_dev != listing->device || info.st_ino != listing->inode
+               || info.st_mtim.tv_sec != listing->modified.tv_sec
+               || info.st_mtim.tv_nsec != listing->modified.tv_nsec;
+}
+
+void scanDirectory(t_directoryListing* listing, int executablesOnly)
+/*lists a directory into listing, sorted by name. getdents64() hands back as
+many entries as fit in 64 KB per call, which matters on network mounts, and
+the entry type it reports spares a stat() for most of them*/
+{
+        static __thread char entries[READ_CHUNK_LENGTH];//globbing lists from several threads
+        struct stat info;
+        long count;
+
+        for (int i = 0; i < listing->numEntries; i++)
+                free(listing->entries[i].name);
+        listing->numEntries = 0;
+        listing->scanned = TRUE;
+        int directory = open(listing->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory == -1)
+                return;
+        if (fstat(directory, &info) == 0) {
+                listing->device = info.st_dev;
+                listing->inode = info.st_ino;
+                listing->modified = info.st_mtim;
+        }
+        while ((count = syscall(SYS_getdents64, directory, entries, sizeof(entries))) > 0) {
+                for (long offset = 0; offset < count; ) {
+                        t_directoryEntry *entry = (t_directoryEntry*) (entries + offset);
+                        offset += entry->d_reclen;
+                        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                                continue;
+                        int isDirectory = (entry->d_type == DT_DIR);
+                        int isLink = (entry->d_type == DT_LNK);
+                        if (executablesOnly) {//commands are executable regular files
+                                if (isDirectory || fstatat(directory, entry->d_name, &info, 0) == -1
+                                    || !S_ISREG(info.st_mode) || (info.st_mode & 0111) == 0)
+                                        continue;
+                        } else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                                if (entry->d_type == DT_UNKNOWN)
+                                        isLink = fstatat(directory, entry->d_name, &info,
+                                                         AT_SYMLINK_NOFOLLOW) == 0
+                                                 && S_ISLNK(info.st_mode);
+                                isDirectory = fstatat(directory, entry->d_name, &info, 0) == 0
+                                              && S_ISDIR(info.st_mode);
+                        }
+                        if (listing->numEntries == listing->capacity) {
+                                listing->capacity = listing->capacity ? 2 * listing->capacity : 64;
+                                listing->entries = realloc(listing->entries, listing->capacity
+                                                           * sizeof(t_listedName));
+                        }
+                        listing->entries[listing->numEntries].name = strdup(entry->d_name);
+                        listing->entries[listing->numEntries].isDirectory = isDirectory;
+                        listing->entries[listing->numEntries].isLink = isLink;
+                        listing->numEntries++;
+                }
+        }
+        close(directory);
+        if (listing->numEntries > 0)//entries is NULL for an empty directory
+                qsort(listing->entries, listing->numEntries, sizeof(t_listedName), compareStrings);
+}
+
+void freeListing(t_directoryListing* listing)
+{
+        for (int i = 0; i < listing->numEntries; i++)
+                free(listing->entries[i].name);
+        free(listing->entries);
+        free(listing->path);
+        memset(listing, 0, sizeof(t_directoryListing));
+}
+
+int findFirstName(void *names, int numNames, size_t size, const char *prefix)
+/*binary search in an array sorted by name (of char* or of t_listedName, both
+starting with the name) for the first one not before prefix*/
+{
+        int low = 0, high = numNames;
+        while (low < high) {
+                int middle = (low + high) / 2;
+                if (strcmp(*(char**) ((char*) names + middle * size), prefix) < 0)
+                        low = middle + 1;
+                else
+                        high = middle;
+        }
+        return low;
+}
+
+void addCompletion(const char *text)
+{
+        if (numCompletions == completionsCapacity) {
+                completionsCapacity = completionsCapacity ? 2 * completionsCapacity : 64;
+                completions = realloc(completions, completionsCapacity * sizeof(char*));
+        }
+        completions[numCompletions++] = strdup(text);
+}
+
+int compareStrings(const void *first, const void *second)//for qsort(), also of t_listedName
+{
+        return strcmp(*(char* const*) first, *(char* const*) second);
+}
@@ -8,20 +8,178 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
 #define TRUE 1
 #define FALSE !TRUE
 
 
 
-#define BUFFER_MAX_LENGTH 50
-static char* currentDirectory;
-static char userInput = '\0';
-static char buffer[BUFFER_MAX_LENGTH];
-static int bufferChars = 0;
-
-static char *commandArgv[5];
+#define READ_CHUNK_LENGTH 65536
+static char* currentDirectory;//the logical one, kept by changeDirectory()
+
+/*The prompt is rendered into promptText. The git branch for %b is looked up
+by promptWorker: the shell posts the directory in branchRequest and the worker
+answers with branchName for branchDirectory, all under promptLock*/
+#define PROMPT_TIMEOUT_MS 20
+static char *promptText = NULL;
+static size_t promptLength = 0;
+static size_t promptCapacity = 0;
+static pthread_t promptWorker;
+static int promptWorkerStarted = FALSE;
+static pthread_mutex_t promptLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t branchRequested = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t branchAnswered = PTHREAD_COND_INITIALIZER;
+static char *branchRequest = NULL;
+static int branchReady = FALSE;
+static char *branchDirectory = NULL;
+static char branchName[256];
+static char shownBranch[256];
+
+/*Input is read() in large chunks; getTextLine() cuts lines out of readBuffer
+and copies each into buffer, which parseCommandLine() turns into the command
+tree. buffer grows geometrically and is reused for every line; commandArgv is
+the argv of the builtin being run*/
+static int MSH_INPUT = STDIN_FILENO;
+static char readBuffer[READ_CHUNK_LENGTH];
+static size_t readStart = 0;
+static size_t readEnd = 0;
+
+static char* buffer = NULL;
+static size_t bufferCapacity = 0;
+static size_t bufferChars = 0;
+
+static char **commandArgv = NULL;
 static int commandArgc = 0;
 
+/*The command tree of a line, built by parser.h. Words and nodes are
+allocated from an arena of chunks that is emptied, not freed, when the next
+line is read, so parsing a line does not call malloc() once warmed up*/
+#define ARENA_BLOCK_LENGTH 16384
+
+typedef struct arenaBlock {
+        struct arenaBlock *next;
+        size_t size;
+        size_t used;
+        char data[];
+} t_arenaBlock;
+
+static t_arenaBlock* arenaFirst = NULL;
+static t_arenaBlock* arenaCurrent = NULL;
+
+#define TOKEN_END 0
+#define TOKEN_WORD 1
+#define TOKEN_PIPE 2
+#define TOKEN_AND 3
+#define TOKEN_OR 4
+#define TOKEN_BACKGROUND 5
+#define TOKEN_SEMICOLON 6
+#define TOKEN_REDIRECTION 7//see redirectType and redirectDescriptor
+#define TOKEN_ERROR 8//unterminated quote
+
+#define REDIRECT_INPUT 1//descriptor < target
+#define REDIRECT_OUTPUT 2//descriptor > target
+#define REDIRECT_APPEND 3//descriptor >> target
+#define REDIRECT_DUPLICATE 4//descriptor >& source, or <&; closes it for -
+#define REDIRECT_HERE_STRING 5//<<< target
+#define REDIRECT_HERE_DOCUMENT 6//<< delimiter, target is the body once read
+
+#define CONNECT_SEQUENCE 0//runs whatever the previous pipeline returned
+#define CONNECT_AND 1//runs only if it succeeded
+#define CONNECT_OR 2//runs only if it failed
+
+typedef struct redirection {
+        int type;
+        int descriptor;//of the command that is redirected
+        char *target;
+        int source;//what descriptor becomes, opened by the shell; -1 if not open
+        int stripTabs;//for <<-
+        struct redirection *next;
+} t_redirection;
+
+typedef struct command {
+        char **argv;
+        int argc;
+        t_redirection *redirections;//applied in order, after the pipes
+        struct command *next;//next stage of the pipeline
+        char **assignments;//the NAME=value words before argv
+        int numAssignments;
+        int expands;//some word holds a $ reference, see expandPipeline()
+} t_command;
+
+typedef struct pipeline {
+        t_command *commands;
+        int numCommands;
+        int executionMode;//FOREGROUND or BACKGROUND
+        int timed;//prefixed with time
+        int connector;//how it depends on the pipeline before it
+        char *backgroundFile;//of bg in/out, NULL otherwise
+        int backgroundDescriptor;//STDIN or STDOUT for bg in/out
+        char *text;//as it was typed, the name of its job
+        char **limits;//limit's --option and value pairs, NULL without limit
+        struct pipeline *next;
+} t_pipeline;
+
+static t_pipeline* commandLine = NULL;//the parsed line, NULL if empty or invalid
+
+/*Lexer state*/
+static char* lexerPosition;
+static char* tokenStart;
+static char* tokenText;
+static int tokenQuoted;
+static int tokenExpands;//the word holds VARIABLE_ or GLOB_ marks
+static int tokenAssignment;//the word is NAME=value
+static int parsedToken;
+/*What nextToken() sets, kept to look one word ahead and go back*/
+typedef struct {
+        char *lexerPosition;
+        char *tokenStart;
+        char *tokenText;
+        int tokenQuoted;
+        int tokenExpands;
+        int tokenAssignment;
+        int redirectDescriptor;
+} t_token;
+static char* wordBuffer = NULL;
+static size_t wordLength = 0;
+static size_t wordCapacity = 0;
+static char** arguments = NULL;//words of the command being parsed
+static int argumentsCapacity = 0;
+/*In a word, the lexer turns $NAME, ${NAME}, $? and $$ into the name between
+two marks: VARIABLE_SPLIT when the reference was unquoted, so its value is
+split on blanks, VARIABLE_QUOTED inside double quotes. An unquoted *, ? or [
+gets GLOB_MARK in front, for globbing.h. A mark that was in the input is
+written twice*/
+#define VARIABLE_SPLIT '\001'
+#define VARIABLE_QUOTED '\002'
+#define GLOB_MARK '\003'
+static int redirectType;//of a TOKEN_REDIRECTION
+static int redirectDescriptor;
+static t_redirection** hereDocuments = NULL;//of the line, in order
+static int numHereDocuments = 0;
+static int hereDocumentsCapacity = 0;
+
 
 #define FOREGROUND 'F'
 #define BACKGROUND 'B'
@@ -46,20 +204,391 @@ typedef struct job {
         pid_t pgid;
         int status;
         char *descriptor;
-        struct job *next;
+        pid_t *processes;//one pid per pipeline stage, 0 once reaped
+        int numProcesses;
+        int runningProcesses;
+        int termination;//wait status of the last stage, which is the job's
+        int taskIndex;//position in a parallel run, -1 for other jobs
+        struct timespec started;//CLOCK_MONOTONIC
+        struct rusage usage;//summed over the stages reaped so far
+        struct termios terminalModes;//as the job left the terminal when it stopped
+        int hasTerminalModes;
+        int stopSignal;//that stopped it, 0 while it runs
+        char *cgroup;//the one limit made for it, NULL otherwise
+        char *placement;//the CPUs and node it was put on, NULL if anywhere
+        struct job *statusPrev;//neighbours in the list of jobs sharing a status
+        struct job *statusNext;
 } t_job;
 
-static t_job* jobsList = NULL;
+/*The job table: slot i holds the job with id i + 1 (NULL when free), so a
+lookup by job id is an array access. A new job takes the lowest free id, so
+the table is only as long as the most jobs ever alive at once*/
+static t_job** jobSlots = NULL;
+static int jobSlotsCapacity = 0;
+static int lastJobId = 0;
+static int freeJobSlot = 0;//every slot below it is taken
+
+/*Open-addressing hash index (linear probing) from a pid to its job*/
+typedef struct {
+        pid_t pid;
+        t_job *job;
+} t_pidEntry;
+
+static t_pidEntry* pidIndex = NULL;
+static int pidIndexCapacity = 0;//always a power of two
+static int pidIndexCount = 0;
+
+/*jobs --json and --tsv. Every change to the job table bumps
+jobTableGeneration; the text of the last listing is kept with the generation
+it was made from, and printed again as is while nothing has changed*/
+#define JOBS_JSON 1
+#define JOBS_TSV 2
+static unsigned long jobTableGeneration = 0;
+static unsigned long jobsListingGeneration = 0;
+static int jobsListingFormat = 0;//none yet
+static char* jobsListing = NULL;
+static size_t jobsListingLength = 0;
+static size_t jobsListingCapacity = 0;
+
+/*The jobs the wait builtin is waiting for, indexed by job id - 1;
+handleChildEvents() fills in how each one finished*/
+typedef struct {
+        int waited;
+        int finished;
+        int status;//as $? reports it
+        int descriptor;//the pidfd watched for it, -1 if none
+} t_waitSlot;
+
+static t_waitSlot* waitSlots = NULL;
+static int numWaitSlots = 0;
+static int numWaitsFinished = 0;
+static int firstWaitFinished = 0;//the id of the job wait -n returns for
+
+/*Background jobs handleChildEvents() reaped, with how they finished, so
+wait %n or wait pid still gets the status of a job that is gone. A script
+keeps them until wait used them, FINISHED_JOBS_KEPT at most; an interactive
+shell until the line typed under their Done notification has run*/
+#define FINISHED_JOBS_KEPT 1024
+typedef struct {
+        int id;
+        pid_t pid;
+        int status;//as $? reports it
+} t_finishedJob;
+
+static t_finishedJob finishedJobs[FINISHED_JOBS_KEPT];
+static int numFinishedJobs = 0;
+
+/*Head of the list of jobs in each status, see statusListOf()*/
+static t_job* statusLists[4];
 
 
 
 static pid_t MSH_PID;
 static pid_t MSH_PGID;
 static int MSH_TERMINAL, MSH_IS_INTERACTIVE;
-static struct termios MSH_TMODES;
-
-void pipelining(int);
-void getTextLine();
+static int MSH_BATCH_MODE = FALSE;//running a script or -c command
+static int lastExitStatus = 0;//of the last foreground job
+static struct rusage lastForegroundUsage;//and what it used, for time
+static double lastForegroundWall = 0;
+static int lastForegroundFinished = FALSE;
+static int MSH_USE_SPAWN = TRUE;//MSH_LAUNCH=fork in the environment turns it off
+
+static const char *builtInCommands[] = {
+        "exit", "cd", "bg", "fg", "jobs", "kill", "wait", "hash", "parallel", "history",
+        "export", "unset", NULL
+};
+
+/*Job events, see events.h. eventHead and eventTail only grow; a slot is
+their value modulo EVENT_RING_LENGTH*/
+#define EVENT_LAUNCH 0//one per process started with posix_spawn()
+#define EVENT_EXIT 1//the job finished
+#define EVENT_SIGNAL 2//the job was killed by a signal
+#define EVENT_STOP 3
+#define EVENT_CONTINUE 4
+#define EVENT_FOREGROUND 5//a job started in the foreground, or fg
+#define EVENT_BACKGROUND 6//a job started in the background, or bg
+#define EVENT_FORK 7//a launch through fork(), see recordJobEvent()
+#define EVENT_RING_LENGTH 4096//a power of two
+#define LAUNCH_RATE_SECONDS 10//launches per second are averaged over these
+#define LAUNCH_LATENCY_SAMPLES 1024//the latest launches, for the quantiles
+
+typedef struct {
+        int type;
+        int jobId;
+        pid_t pgid;
+        pid_t pid;
+        int firstProcess;//of its job
+        int termination;//wait status, for EVENT_EXIT and EVENT_SIGNAL
+        long latency;//ns posix_spawn() or fork() took, for EVENT_LAUNCH and EVENT_FORK
+        struct timespec time;//CLOCK_REALTIME
+        struct rusage usage;//of the whole job, for EVENT_EXIT and EVENT_SIGNAL
+        char name[128];//of the job, cut short if need be
+} t_jobEvent;
+
+typedef struct {
+        time_t second;
+        long launches;
+} t_launchBucket;
+
+static t_jobEvent eventRing[EVENT_RING_LENGTH];
+static atomic_size_t eventHead = 0;//written by the shell
+static atomic_size_t eventTail = 0;//written by eventWriter
+static atomic_long eventsDropped = 0;
+static atomic_int eventWriterStopping = FALSE;
+static int eventsEnabled = FALSE;
+static int eventWakeup = -1;//an eventfd
+static int eventLog = -1;
+static int metricsSocket = -1;
+static char* metricsPath = NULL;//where metricsSocket is bound, removed at exit
+static pthread_t eventWriter;
+static pid_t eventWriterProcess;
+/*Counters, only touched by eventWriter*/
+static long launchesTotal = 0;
+static long jobsStarted = 0;
+static long jobsFinished = 0;
+static t_launchBucket launchBuckets[LAUNCH_RATE_SECONDS];
+static long launchLatencies[2][LAUNCH_LATENCY_SAMPLES];//of spawns, then of forks
+static long numLaunchLatencies[2] = { 0, 0 };
+
+/*Shell variables, see variables.h. Open addressing with linear probing like
+the command hash. Each one is kept as its "NAME=value" string, so the
+environment handed to commands is an array of pointers to the exported ones,
+rebuilt only after one of them changed*/
+typedef struct {
+        char *text;//"NAME=value", NULL for an empty slot
+        size_t nameLength;
+        int exported;
+} t_variable;
+
+static t_variable* variables = NULL;
+static int variablesCapacity = 0;//always a power of two
+static int variablesCount = 0;
+static char** environment = NULL;//of commands, NULL terminated
+static int environmentDirty = TRUE;
+
+/*Command hash: maps a command name to the absolute path found in PATH, so
+launches do not probe every PATH directory again. Open addressing with
+linear probing; everything is dropped when PATH is set*/
+typedef struct {
+        char *name;//NULL for an empty slot
+        char *path;
+        unsigned int hits;
+} t_hashedCommand;
+
+static t_hashedCommand* commandCache = NULL;
+static int commandCacheCapacity = 0;//always a power of two
+static int commandCacheCount = 0;
+
+/*Command history, see history.h. The entries loaded at startup point into
+historyMap, the ones typed since into memory of their own*/
+typedef struct {
+        char *text;//not NUL terminated
+        uint32_t length;
+} t_historyEntry;
+
+/*In the file every line is a record: this header, then the text. No line
+holds a NUL, so after a record a dying shell left unfinished the next one is
+found again by its marker*/
+#define HISTORY_MARKER "\0MSH"
+typedef struct {
+        char marker[4];//HISTORY_MARKER
+        uint32_t length;//of the text
+        uint32_t check;//~length
+} t_historyHeader;
+
+/*The search index: each entry's trigrams are hashed into one of
+HISTORY_BUCKETS, and the row of a bucket has a bit for every block of
+HISTORY_BLOCK entries, set if an entry of the block has such a trigram.
+history -s ANDs the rows of the trigrams of the text, and only reads the
+entries of the blocks left*/
+#define HISTORY_BUCKETS 4096//a power of two
+#define HISTORY_BLOCK 32
+static uint64_t* historyIndex = NULL;//HISTORY_BUCKETS rows of historyIndexWords
+static size_t historyIndexWords = 0;
+static int numIndexedEntries = 0;
+
+static int historyDescriptor = -1;//the history file, opened O_APPEND
+static char* historyMap = NULL;
+static size_t historyMapLength = 0;
+static t_historyEntry* historyEntries = NULL;
+static int numHistoryEntries = 0;
+static int historyEntriesCapacity = 0;
+
+/*Line editor, see editor.h. The line itself is edited in buffer*/
+/*CTRL(key) comes from <termios.h>*/
+#define KEY_UP 1000//keys sent as escape sequences
+#define KEY_DOWN 1001
+#define KEY_RIGHT 1002
+#define KEY_LEFT 1003
+#define KEY_HOME 1004
+#define KEY_END 1005
+#define KEY_DELETE 1006
+
+static size_t editorCursor = 0;//position in buffer
+static char* editorShown = NULL;//what the terminal shows after the prompt
+static size_t editorShownLength = 0;
+static size_t editorShownCapacity = 0;
+static size_t editorShownColumn = 0;//where the terminal's cursor is
+static size_t editorColumns = 80;//width of the terminal, the line wraps there
+static size_t editorPromptColumns = 0;//taken by the prompt, on the line's first row
+static char* editorOutput = NULL;//escape sequences and text for the next write()
+static size_t editorOutputLength = 0;
+static size_t editorOutputCapacity = 0;
+static char* editorScratch = NULL;
+static size_t editorScratchLength = 0;
+static size_t editorScratchCapacity = 0;
+static char* editorSaved = NULL;//the line as typed, while history is shown
+static size_t editorSavedLength = 0;
+static size_t editorSavedCapacity = 0;
+static char* editorQuery = NULL;//of a Ctrl-R search
+static size_t editorQueryLength = 0;
+static size_t editorQueryCapacity = 0;
+static int editorSearching = FALSE;
+static int editorSearchMatch = 0;
+static int editorLastKey = 0;
+static int historyPosition = 0;//entry shown by up and down, numHistoryEntries for the line
+static char** completions = NULL;
+static int numCompletions = 0;
+static int completionsCapacity = 0;
+
+/*Directory listings kept for completion, see completion.h*/
+typedef struct {//as getdents64() returns them
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+} t_directoryEntry;
+
+typedef struct {
+        char *name;//first, so the entries sort like strings
+        int isDirectory;
+        int isLink;//a symbolic link, isDirectory telling what it leads to
+} t_listedName;
+
+typedef struct {
+        char *path;
+        dev_t device;//the directory as it was when listed
+        ino_t inode;
+        struct timespec modified;
+        int scanned;
+        t_listedName *entries;//sorted by name
+        int numEntries;
+        int capacity;
+} t_directoryListing;
+
+static t_directoryListing* pathListings = NULL;//one per PATH directory
+static int numPathListings = 0;
+static char* indexedSearchPath = NULL;
+static char** commandNames = NULL;//of all of them, sorted and unique
+static int numCommandNames = 0;
+static int commandNamesCapacity = 0;
+static t_directoryListing fileListing;//the last directory file names came from
+
+/*Globbing, see globbing.h. The listings of the directories patterns were
+matched in, by path; globLock guards them while a ** walk runs*/
+typedef struct {
+        t_directoryListing *listing;//NULL in an empty slot
+        unsigned long checkedLine;//the globLine it was last found unchanged in
+} t_cachedListing;
+
+static t_cachedListing* globCache = NULL;
+static int globCacheCapacity = 0;//a power of two
+static int globCacheCount = 0;
+static unsigned long globLine = 0;//counts the command lines run
+static pthread_mutex_t globLock = PTHREAD_MUTEX_INITIALIZER;
+static t_directoryListing** retiredListings = NULL;//replaced while in use, freed after
+static int numRetiredListings = 0;
+static int retiredListingsCapacity = 0;
+#define GLOB_CACHE_LIMIT 4096//directories; the cache is emptied past it
+#define GLOB_THREADS 4//the most threads a ** walk takes
+
+typedef struct {//the paths a pattern matched, malloc()ed
+        char **paths;
+        int count;
+        int capacity;
+} t_globMatches;
+
+typedef struct {//shared by the threads walking the directories under a **
+        char **directories;//still to be listed
+        int numDirectories;
+        int directoriesCapacity;
+        int busy;//threads listing one right now
+        const char *rest;//the pattern after the **
+        pthread_mutex_t lock;
+        pthread_cond_t changed;
+} t_globWalk;
+
+typedef struct {
+        t_globWalk *walk;
+        t_globMatches matches;//of this thread
+        pthread_t thread;
+} t_globWorker;
+
+/*Resource limits of a job, see resources.h. The cgroup v2 ones are written to
+its cgroup by the shell; the rest are setrlimit() calls made by each process
+of the job before its exec*/
+#define LIMIT_RESOURCES 16
+#define CPU_PERIOD 100000//of cpu.max, in microseconds
+
+typedef struct {
+        long long memory;//memory.max in bytes, -1 when not limited
+        double cpus;//cpu.max as a number of CPUs, 0 when not limited
+        long pids;//pids.max, -1 when not limited
+        int resources[LIMIT_RESOURCES];//for setrlimit()
+        rlim_t values[LIMIT_RESOURCES];
+        int numResources;
+        char *cgroup;//the job's, NULL when none could be made
+        int procsDescriptor;//its cgroup.procs, which each process writes itself into
+        cpu_set_t affinity;//sched_setaffinity(), if hasCpus
+        int hasCpus;
+        int numaNode;//set_mempolicy() binds memory to it, -1 for none
+} t_limits;
+
+static char* cgroupParent = NULL;//the cgroup the jobs' ones are made in
+static int cgroupsChecked = FALSE;//whether cgroupParent was looked for
+static int numCgroups = 0;//made so far, they are numbered
+
+/*Command substitution, see substitution.h. What parsing the command of one
+sets, saved while it runs: the parser is in the middle of the outer line*/
+typedef struct {
+        char *lexerPosition;
+        char *tokenStart;
+        char *tokenText;
+        int tokenQuoted;
+        int tokenExpands;
+        int tokenAssignment;
+        int parsedToken;
+        int redirectType;
+        int redirectDescriptor;
+        char *wordBuffer;
+        size_t wordLength;
+        size_t wordCapacity;
+        char **arguments;
+        int argumentsCapacity;
+        t_pipeline *commandLine;
+} t_parserState;
+
+static char* outputText = NULL;//of the last command substitution
+static size_t outputLength = 0;
+static size_t outputCapacity = 0;
+static int outputCaptured = FALSE;//stdout is captureBuiltIn()'s memfd
+
+/*State of the running parallel builtin*/
+static int parallelRunning = 0;
+static int parallelFailed = 0;
+static volatile int MSH_INTERRUPTED = FALSE;//SIGINT read from the signalfd
+static struct termios MSH_TMODES;//the shell's own, put back after every foreground job
+static struct termios MSH_EDITOR_TMODES;//raw mode, while a line is edited
+/*SIGCHLD is kept blocked in the shell and delivered through this signalfd,
+so children are only ever reaped from the main loop and from waitJob()*/
+static int MSH_CHILD_FD = -1;
+static sigset_t MSH_CHILD_MASK;
+/*SIGWINCH, blocked the same way in an interactive shell; the editor polls it
+with its input and reads the new width*/
+static int MSH_RESIZE_FD = -1;
+
+int getTextLine();
 
 void populateCommand();
 
@@ -68,11 +597,17 @@ void destroyCommand();
 t_job * insertJob(pid_t pid, pid_t pgid, char* name, char* descriptor,
                   int status);
 
-t_job* delJob(t_job* job);
+void delJob(t_job* job);
+
+int changeJobStatus(int pid, int status);
 
 t_job* getJob(int searchValue, int searchParameter);
 
-void printJobs();
+void printJobs(int longFormat);
+
+void printJobsListing(int format);
+
+void formatJob(t_job* job, int format, int notFirst);
 
 void welcomeScreen();
 
@@ -81,11 +616,11 @@ void handleUserCommand();
 
 int checkBuiltInCommands();
 
-void executeCommand(char *command[], char *file, int newDescriptor,
-                    int executionMode);
+void executeCommand(t_command* command);
+
+void launchJob(t_pipeline* pipeline);
 
-void launchJob(char *command[], char *file, int newDescriptor,
-               int executionMode);
+void runPipeline(t_pipeline* pipeline);
 
 void putJobForeground(t_job* job, int continueJob);
 
@@ -93,10 +628,342 @@ void putJobBackground(t_job* job, int continueJob);
 
 void waitJob(t_job* job);
 
-void killJob(int jobId);
+void killJobs();
+
+int parseSignal(const char *name);
+
+void waitJobs();
+
+int watchJob(int poller, t_job* job);
+
+void finishWait(t_job* job, int status);
+
+void keepFinishedJob(t_job* job);
+
+int takeFinishedJob(const char *target);
+
+int jobExitStatus(int termination);
 
 void changeDirectory();
 
 void init();
 
-void signalHandler_child(int p);
+void handleChildEvents();
+
+t_job** statusListOf(int status);
+
+void indexPid(pid_t pid, t_job* job);
+
+void unindexPid(pid_t pid);
+
+void addJobProcess(t_job* job, pid_t pid);
+
+void removeJobProcess(t_job* job, pid_t pid);
+
+int openDataDescriptor(const char *data, size_t length, int newline);
+
+void parseArguments(int argc, char **argv);
+
+int signalJob(t_job* job, int signalNumber);
+
+void setJobStatus(t_job* job, int status);
+
+pid_t spawnProcess(t_command* command, int executionMode, pid_t pgid,
+                   int inputDescriptor, int outputDescriptor);
+
+int isBuiltInCommand(char *name);
+
+int needsForkedShell(t_command* command);
+
+char* resolveCommand(char *name);
+
+t_hashedCommand* findHashedCommand(char *name);
+
+void forgetCommand(char *name);
+
+void clearCommandCache();
+
+void printCommandCache();
+
+int runParallel(char *command[]);
+
+void finishParallelTask(t_job* job);
+
+char* joinArguments(char *command[]);
+
+void timeCommand(t_pipeline* pipeline);
+
+double secondsSince(struct timespec *start);
+
+void addUsage(struct rusage *total, struct rusage *usage);
+
+void sampleProcessUsage(pid_t pid, struct rusage *usage);
+
+void printJobsUsage();
+
+void* arenaAlloc(size_t size);
+
+char* arenaCopy(const char *text, size_t length);
+
+void arenaReset();
+
+void appendToWord(char c);
+
+int nextToken();
+
+t_pipeline* parseCommandLine(char *line);
+
+t_pipeline* parsePipeline();
+
+t_command* parseSimpleCommand();
+
+void* syntaxError();
+
+void readHereDocuments();
+
+int readLine();
+
+int openRedirections(t_command* command);
+
+void closeRedirections(t_command* command);
+
+int applyRedirections(t_command* command);
+
+void runBuiltIn(t_command* command);
+
+void loadHistory();
+
+void addHistoryEntry(char *text, uint32_t length);
+
+void addHistory(char *line, size_t length);
+
+int expandHistory();
+
+void printHistory(int count);
+
+void searchHistory(char *pattern);
+
+void indexHistory();
+
+unsigned trigramBucket(const char *text);
+
+void printHistoryEntry(int i);
+
+int editLine();
+
+void editKey(int key);
+
+int readKey();
+
+int readByte();
+
+int keyPending(int milliseconds);
+
+size_t previousCharacter(size_t position);
+
+size_t nextCharacter(size_t position);
+
+void ensureBuffer(size_t length);
+
+void insertText(const char *text, size_t length);
+
+void deleteText(size_t start, size_t end);
+
+void setLine(const char *text, size_t length);
+
+void showHistoryEntry(int position);
+
+void startSearch();
+
+int searchKey(int key);
+
+void findHistoryMatch(int from);
+
+void refreshLine();
+
+void redrawPrompt();
+
+void moveCursor(size_t from, size_t to);
+
+void leaveLine();
+
+void readColumns();
+
+size_t promptColumns(const char *prompt);
+
+size_t textColumns(const char *text, size_t length);
+
+void appendOutput(const char *text, size_t length);
+
+void flushOutput();
+
+void appendBytes(char **data, size_t *length, size_t *capacity, const char *bytes,
+                 size_t count);
+
+void completeWord();
+
+void collectCompletions(char *prefix, int isCommand);
+
+void refreshCommandIndex();
+
+int listingChanged(t_directoryListing* listing);
+
+void scanDirectory(t_directoryListing* listing, int executablesOnly);
+
+void freeListing(t_directoryListing* listing);
+
+int findFirstName(void *names, int numNames, size_t size, const char *prefix);
+
+void addCompletion(const char *text);
+
+int compareStrings(const void *first, const void *second);
+
+void renderPrompt();
+
+char* gitBranch();
+
+void* branchWorker(void *unused);
+
+void findGitBranch(const char *directory, char *branch, size_t size);
+
+char* logicalPath(const char *target);
+
+void importEnvironment(char **envp);
+
+t_variable* findVariable(const char *name, size_t length);
+
+char* lookupVariable(const char *name);
+
+void setVariable(const char *name, size_t nameLength, const char *value, int exported);
+
+void unsetVariable(const char *name);
+
+int isVariableName(const char *name, size_t length);
+
+void assignVariables(t_command* command);
+
+char** buildEnvironment();
+
+char** commandEnvironment(t_command* command);
+
+void exportVariables();
+
+void unsetVariables();
+
+size_t variableReference(const char *c, const char **name, size_t *nameLength);
+
+void appendVariable(const char *name, size_t nameLength, char mark);
+
+void appendLiteral(char c);
+
+void appendRunToWord(const char *text, size_t length);
+
+void addArgument(int *argc, char *word);
+
+void saveToken(t_token* token);
+
+void restoreToken(t_token* token);
+
+void expandPipeline(t_pipeline* pipeline);
+
+char* expandWord(char *word, int *argc);
+
+const char* variableValue(const char *name, size_t length);
+
+void startEventWriter();
+
+void stopEventWriter();
+
+int claimSocketPath(struct sockaddr_un* address);
+
+void recordJobEvent(int type, t_job* job, pid_t pid, long latency);
+
+void* writeEvents(void *unused);
+
+void countEvent(t_jobEvent* event);
+
+void formatEvent(t_jobEvent* event, char **line, size_t *length, size_t *capacity);
+
+void formatMetrics(char **text, size_t *length, size_t *capacity);
+
+void appendJsonString(char **data, size_t *length, size_t *capacity, const char *text);
+
+int compareLongs(const void *first, const void *second);
+
+void globWord(char *word, int *argc);
+
+int isPattern(const char *word);
+
+char* removeGlobMarks(char *word);
+
+void globPath(const char *base, const char *pattern, t_globMatches* matches, int parallel);
+
+void globDirectories(const char *base, const char *rest, t_globMatches* matches, int parallel);
+
+void* walkDirectories(void *argument);
+
+void addGlobMatch(t_globMatches* matches, const char *base, const char *name, int slash);
+
+int matchPattern(const char *pattern, const char *name);
+
+int bracketLength(const char *pattern);
+
+int matchBracket(const char *pattern, char c);
+
+t_directoryListing* cachedListing(const char *base);
+
+t_cachedListing* findCachedListing(const char *path);
+
+void clearGlobCache();
+
+size_t substitutionLength(const char *c);
+
+void appendSubstitution(const char *c, size_t length, char mark);
+
+const char* commandOutput(const char *text, size_t length);
+
+int printsOnly(t_pipeline* pipeline);
+
+void captureBuiltIn(t_command* command);
+
+void captureSubshell(t_pipeline* pipeline);
+
+void readOutput(int descriptor);
+
+void saveParser(t_parserState* state);
+
+void restoreParser(t_parserState* state);
+
+int parseLimits(char **options, t_limits* limits);
+
+long long parseSize(const char *text);
+
+void addResourceLimit(t_limits* limits, int resource, rlim_t value);
+
+int makeJobCgroup(t_limits* limits);
+
+void warnFallback(const char *option, const char *controller, const char *instead);
+
+char* findCgroupParent();
+
+int writeCgroupFile(const char *cgroup, const char *name, const char *value);
+
+void enterLimits(t_limits* limits);
+
+void removeJobCgroup(t_job* job);
+
+void printJobPressure(t_job* job);
+
+double readPressure(const char *cgroup, const char *name);
+
+void clearLimits(t_limits* limits);
+
+int placeJob(t_limits* limits, int executionMode);
+
+int parseCpuList(const char *text, cpu_set_t *cpus);
+
+int readNodeCpus(int node, cpu_set_t *cpus);
+
+char* describePlacement(t_limits* limits);
+
+void printJobPlacement(t_job* job);
@@ -0,0 +1,530 @@
+/*Line editor of the interactive shell. The terminal is put in raw mode only
+while a line is being typed, and each key is applied to buffer, which then
+holds the line exactly as getTextLine() would have read it. The screen is
+kept in step by refreshLine(): it compares the line with what is shown,
+rewrites only what follows the first difference, and sends all of it with one
+write(). When several keys arrive at once, as when text is pasted, the
+screen is only brought up to date after the last of them. A line longer than
+the terminal is wide wraps onto more rows, and the cursor moves across them*/
+
+int editLine()//reads a line from the terminal into buffer, EOF at the end of input
+{
+        int result = -2;
+
+        bufferChars = 0;
+        editorCursor = 0;
+        editorShownLength = 0;
+        editorShownColumn = 0;
+        editorSearching = FALSE;
+        editorLastKey = 0;
+        historyPosition = numHistoryEntries;
+        editorPromptColumns = promptColumns(promptText);
+        readColumns();
+        ensureBuffer(1);
+        tcsetattr(MSH_TERMINAL, TCSADRAIN, &MSH_EDITOR_TMODES);
+        while (result == -2) {
+                int key = readKey();
+                if (editorSearching && searchKey(key))
+                        ;//consumed by the search
+                else if (key == -1 || (key == CTRL('D') && bufferChars == 0))
+                        result = EOF;
+                else if (key == '\r' || key == '\n')
+                        result = bufferChars;
+                else
+                        editKey(key);
+                editorLastKey = key;
+                if (result == -2 && keyPending(0))
+                        continue;//draw once the whole burst is applied
+                refreshLine();
+        }
+        if (result != EOF) {
+                leaveLine();
+                appendOutput("\n", 1);
+        }
+        flushOutput();
+        tcsetattr(MSH_TERMINAL, TCSADRAIN, &MSH_TMODES);
+        buffer[bufferChars] = '\0';
+        return result;
+}
+
+void editKey(int key)//applies one key outside of a history search
+{
+        switch (key) {
+        case KEY_LEFT:
+        case CTRL('B'):
+                editorCursor = previousCharacter(editorCursor);
+                break;
+        case KEY_RIGHT:
+        case CTRL('F'):
+                editorCursor = nextCharacter(editorCursor);
+                break;
+        case KEY_HOME:
+        case CTRL('A'):
+                editorCursor = 0;
+                break;
+        case KEY_END:
+        case CTRL('E'):
+                editorCursor = bufferChars;
+                break;
+        case KEY_UP:
+        case CTRL('P'):
+                showHistoryEntry(historyPosition - 1);
+                break;
+        case KEY_DOWN:
+        case CTRL('N'):
+                showHistoryEntry(historyPosition + 1);
+                break;
+        case 127://backspace
+        case CTRL('H'):
+                deleteText(previousCharacter(editorCursor), editorCursor);
+                break;
+        case KEY_DELETE:
+        case CTRL('D'):
+                deleteText(editorCursor, nextCharacter(editorCursor));
+                break;
+        case CTRL('K'):
+                deleteText(editorCursor, bufferChars);
+                break;
+        case CTRL('U'):
+                deleteText(0, editorCursor);
+                break;
+        case CTRL('W'): {//the word before the cursor
+                size_t start = editorCursor;
+                while (start > 0 && (buffer[start - 1] == ' ' || buffer[start - 1] == '\t'))
+                        start--;
+                while (start > 0 && buffer[start - 1] != ' ' && buffer[start - 1] != '\t')
+                        start--;
+                deleteText(start, editorCursor);
+                break;
+        }
+        case CTRL('C')://drop the line, like SIGINT would in a shell reading in cooked mode
+                leaveLine();
+                appendOutput("^C\n", 3);
+                bufferChars = editorCursor = 0;
+                lastExitStatus = 130;
+                redrawPrompt();
+                break;
+        case CTRL('L'):
+                appendOutput("\x1b[H\x1b[2J", 7);
+                redrawPrompt();
+                break;
+        case CTRL('R'):
+                startSearch();
+                break;
+        case '\t':
+                completeWord();
+                break;
+        default:
+                if (key >= ' ' && key < 256) {
+                        char c = (char) key;
+                        insertText(&c, 1);
+                }
+                break;
+        }
+}
+
+int readKey()//the next key, with escape sequences decoded to KEY_ codes; -1 at EOF
+{
+        int c = readByte();
+        if (c != 27 || !keyPending(50))//a lone escape
+                return c;
+        int kind = readByte();
+        if (kind == -1)
+                return 27;
+        if (kind == 'O')//ESC O x, what some terminals send for the arrows
+                c = readByte();
+        else if (kind != '[')
+                return 0;//Alt and a key, not bound
+        /*ESC [ parameters intermediates final: the first parameter is the n of
+        ESC [ n ~, the rest, like the 5 of Ctrl-Right's ESC [ 1 ; 5 C, says
+        which modifiers were held and is read past*/
+        int number = 0, parameter = 0;
+        if (kind == '[') {
+                while ((c = readByte()) >= 0x20 && c <= 0x3F) {
+                        if (c == ';' || c < 0x30)
+                                parameter++;
+                        else if (parameter == 0 && c >= '0' && c <= '9')
+                                number = 10 * number + c - '0';
+                }
+                if (c < 0x40 || c > 0x7E)
+                        return 0;//not a sequence after all, or EOF
+        }
+        switch (c) {
+        case 'A':
+                return KEY_UP;
+        case 'B':
+                return KEY_DOWN;
+        case 'C':
+                return KEY_RIGHT;
+        case 'D':
+                return KEY_LEFT;
+        case 'H':
+                return KEY_HOME;
+        case 'F':
+                return KEY_END;
+        case '~'://ESC [ n ~
+                return number == 1 || number == 7 ? KEY_HOME :
+                       number == 4 || number == 8 ? KEY_END :
+                       number == 3 ? KEY_DELETE : 0;
+        }
+        return 0;//ignored
+}
+
+int readByte()//input goes through the same buffer readLine() uses
+{
+        if (readStart == readEnd) {
+                struct pollfd ready[2] = { { MSH_INPUT, POLLIN, 0 }, { MSH_RESIZE_FD, POLLIN, 0 } };
+                struct signalfd_siginfo info;
+                ssize_t count;
+                while (MSH_RESIZE_FD != -1 && (poll(ready, 2, -1) == -1 || ready[1].revents)) {
+                        if (ready[1].revents && read(MSH_RESIZE_FD, &info, sizeof(info)) > 0)
+                                readColumns();//used from the next refreshLine() on
+                        ready[1].revents = 0;
+                }
+                do
+                        count = read(MSH_INPUT, readBuffer, READ_CHUNK_LENGTH);
+                while (count == -1 && errno == EINTR);
+                if (count <= 0)
+                        return -1;
+                readStart = 0;
+                readEnd = count;
+        }
+        return (unsigned char) readBuffer[readStart++];
+}
+
+int keyPending(int milliseconds)//whether a key can be read without waiting longer
+{
+        struct pollfd input = { MSH_INPUT, POLLIN, 0 };
+        return readStart < readEnd || poll(&input, 1, milliseconds) > 0;
+}
+
+size_t previousCharacter(size_t position)//UTF-8 continuation bytes are skipped
+{
+        if (position > 0)
+                position--;
+        while (position > 0 && (buffer[position] & 0xC0) == 0x80)
+                position--;
+        return position;
+}
+
+size_t nextCharacter(size_t position)
+{
+        if (position < bufferChars)
+                position++;
+        while (position < bufferChars && (buffer[position] & 0xC0) == 0x80)
+                position++;
+        return position;
+}
+
+void ensureBuffer(size_t length)//room for length characters and the NUL
+{
+        if (length + 1 <= bufferCapacity)
+                return;
+        while (length + 1 > bufferCapacity)
+                bufferCapacity = bufferCapacity ? 2 * bufferCapacity : 256;
+        buffer = realloc(buffer, bufferCapacity);
+}
+
+void insertText(const char *text, size_t length)//at the cursor
+{
+        ensureBuffer(bufferChars + length);
+        memmove(buffer + editorCursor + length, buffer + editorCursor,
+                bufferChars - editorCursor);
+        memcpy(buffer + editorCursor, text, length);
+        bufferChars += length;
+        editorCursor += length;
+}
+
+void deleteText(size_t start, size_t end)
+{
+        memmove(buffer + start, buffer + end, bufferChars - end);
+        bufferChars -= end - start;
+        editorCursor = start;
+}
+
+void setLine(const char *text, size_t length)//replaces the whole line
+{
+        ensureBuffer(length);
+        memcpy(buffer, text, length);
+        bufferChars = editorCursor = length;
+}
+
+void showHistoryEntry(int position)//up and down walk through the history
+{
+        if (position < 0 || position > numHistoryEntries)
+                return;
+        if (historyPosition == numHistoryEntries) {//keep what was being typed
+                editorSavedLength = 0;
+                appendBytes(&editorSaved, &editorSavedLength, &editorSavedCapacity,
+                            buffer, bufferChars);
+        }
+        historyPosition = position;
+        if (position == numHistoryEntries)
+                setLine(editorSaved, editorSavedLength);
+        else
+                setLine(historyEntries[position].text, historyEntries[position].length);
+}
+
+void startSearch()//Ctrl-R: incremental search back through the history
+{
+        editorSearching = TRUE;
+        editorQueryLength = 0;
+        editorSearchMatch = numHistoryEntries;
+        editorSavedLength = 0;
+        appendBytes(&editorSaved, &editorSavedLength, &editorSavedCapacity,
+                    buffer, bufferChars);
+}
+
+int searchKey(int key)
+/*applies a key during a history search. Returns FALSE for a key that ends
+the search and must then be applied to the line as usual*/
+{
+        if (key == CTRL('R')) {//the next older match
+                findHistoryMatch(editorSearchMatch - 1);
+        } else if (key == 127 || key == CTRL('H')) {
+                while (editorQueryLength > 0
+                       && (editorQuery[--editorQueryLength] & 0xC0) == 0x80)
+                        ;
+                findHistoryMatch(numHistoryEntries - 1);
+        } else if (key >= ' ' && key < 256) {
+                char c = (char) key;
+                appendBytes(&editorQuery, &editorQueryLength, &editorQueryCapacity, &c, 1);
+                findHistoryMatch(editorSearchMatch < numHistoryEntries ?
+                                 editorSearchMatch : numHistoryEntries - 1);
+        } else if (key == CTRL('G') || key == 27 || key == CTRL('C')) {//back to the line as it was
+                editorSearching = FALSE;
+                setLine(editorSaved, editorSavedLength);
+        } else {
+                editorSearching = FALSE;//keep the match, and edit or run it
+                return FALSE;
+        }
+        return TRUE;
+}
+
+void findHistoryMatch(int from)//the newest entry from from down holding the query
+{
+        for (int i = from; i >= 0 && i < numHistoryEntries; i--) {
+                t_historyEntry *entry = &historyEntries[i];
+                char *hit = memmem(entry->text, entry->length, editorQuery, editorQueryLength);
+                if (hit != NULL) {
+                        editorSearchMatch = i;
+                        setLine(entry->text, entry->length);
+                        editorCursor = hit - entry->text;
+                        return;
+                }
+        }
+        appendOutput("\a", 1);//nothing older matches, the line stays
+}
+
+void refreshLine()
+/*brings the terminal from what it shows to the line (or to the search
+prompt) with the cursor in place. Only the text after the first difference
+is written again; everything goes out in a single write()*/
+{
+        const char *text = buffer;
+        size_t length = bufferChars;
+        size_t cursor = editorCursor;
+
+        if (editorSearching) {
+                editorScratchLength = 0;
+                appendBytes(&editorScratch, &editorScratchLength, &editorScratchCapacity,
+                            "(reverse-i-search)`", 19);
+                appendBytes(&editorScratch, &editorScratchLength, &editorScratchCapacity,
+                            editorQuery, editorQueryLength);
+                appendBytes(&editorScratch, &editorScratchLength, &editorScratchCapacity,
+                            "': ", 3);
+                cursor += editorScratchLength;
+                appendBytes(&editorScratch, &editorScratchLength, &editorScratchCapacity,
+                            buffer, bufferChars);
+                text = editorScratch;
+                length = editorScratchLength;
+        }
+
+        size_t same = 0;
+        while (same < length && same < editorShownLength && text[same] == editorShown[same])
+                same++;
+        while (same > 0 && same < length && (text[same] & 0xC0) == 0x80)//do not split a character
+                same--;
+        if (same < length || same < editorShownLength) {
+                moveCursor(editorShownColumn, textColumns(text, same));
+                appendOutput(text + same, length - same);
+                editorShownColumn = textColumns(text, length);
+                if (same < length && (editorPromptColumns + editorShownColumn) % editorColumns == 0)
+                        appendOutput("\r\n", 2);//written up to the last column, the terminal waits there
+                if (editorShownColumn < textColumns(editorShown, editorShownLength))
+                        appendOutput("\x1b[J", 3);//clear what is left of a longer line
+        }
+        moveCursor(editorShownColumn, textColumns(text, cursor));
+        editorShownColumn = textColumns(text, cursor);
+        editorShownLength = 0;
+        appendBytes(&editorShown, &editorShownLength, &editorShownCapacity, text, length);
+        flushOutput();
+}
+
+void redrawPrompt()//after the screen was cleared or written over
+{
+        flushOutput();
+        shellPrompt();
+        editorShownLength = 0;
+        editorShownColumn = 0;
+}
+
+void moveCursor(size_t from, size_t to)
+/*along the line, by columns from the end of the prompt, going up or down
+rows where the line wraps*/
+{
+        char move[32];
+        size_t fromRow = (editorPromptColumns + from) / editorColumns;
+        size_t toRow = (editorPromptColumns + to) / editorColumns;
+        size_t fromColumn = (editorPromptColumns + from) % editorColumns;
+        size_t toColumn = (editorPromptColumns + to) % editorColumns;
+        if (toRow < fromRow)
+                appendOutput(move, sprintf(move, "\x1b[%zuA", fromRow - toRow));
+        else if (toRow > fromRow)
+                appendOutput(move, sprintf(move, "\x1b[%zuB", toRow - fromRow));
+        if (toColumn < fromColumn)
+                appendOutput(move, sprintf(move, "\x1b[%zuD", fromColumn - toColumn));
+        else if (toColumn > fromColumn)
+                appendOutput(move, sprintf(move, "\x1b[%zuC", toColumn - fromColumn));
+}
+
+void leaveLine()//puts the cursor after the end of the line shown, for what follows it
+{
+        size_t end = textColumns(editorShown, editorShownLength);
+        moveCursor(editorShownColumn, end);
+        editorShownColumn = end;
+}
+
+void readColumns()//the terminal's width, 80 if it cannot be told
+{
+        struct winsize size;
+        if (ioctl(MSH_TERMINAL, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+                editorColumns = size.ws_col;
+        else
+                editorColumns = 80;
+}
+
+size_t promptColumns(const char *prompt)
+/*where the prompt leaves the cursor: the characters after its last newline,
+less escape sequences like colours, which take no room*/
+{
+        size_t columns = 0;
+        for (const char *c = prompt; *c != '\0'; c++) {
+                if (*c == '\n' || *c == '\r') {
+                        columns = 0;
+                } else if (*c == 27 && c[1] == '[') {
+                        for (c += 2; *c != '\0' && (*c < 0x40 || *c > 0x7E); c++)
+                                ;
+                        if (*c == '\0')
+                                break;
+                } else if ((*c & 0xC0) != 0x80) {
+                        columns++;
+                }
+        }
+        return columns;
+}
+
+size_t textColumns(const char *text, size_t length)//one column per UTF-8 character
+{
+        size_t columns = 0;
+        for (size_t i = 0; i < length; i++)
+                if ((text[i] & 0xC0) != 0x80)
+                        columns++;
+        return columns;
+}
+
+void appendOutput(const char *text, size_t length)
+{
+        appendBytes(&editorOutput, &editorOutputLength, &editorOutputCapacity, text, length);
+}
+
+void flushOutput()//everything queued by appendOutput() in one write()
+{
+        size_t done = 0;
+        while (done < editorOutputLength) {
+                ssize_t written = write(STDOUT_FILENO, editorOutput + done,
+                                        editorOutputLength - done);
+                if (written == -1 && errno == EINTR)
+                        continue;
+                if (written <= 0)
+                        break;
+                done += written;
+        }
+        editorOutputLength = 0;
+}
+
+void appendBytes(char **data, size_t *length, size_t *capacity, const char *bytes,
+                 size_t count)//to a growable byte array
+{
+        if (*length + count > *capacity) {
+                while (*length + count > *capacity)
+                        *capacity = *capacity ? 2 * *capacity : 256;
+                *data = realloc(*data, *capacity);
+        }
+        memcpy(*data + *length, bytes, count);
+        *length += count;
+}
+
+void completeWord()
+/*Tab: completes the word before the cursor as a command name when it is the
+first word of a command, else as a file name. The longest prefix shared by
+all the candidates is inserted; a second Tab lists them*/
+{
+        size_t start = editorCursor;
+        while (start > 0 && (strchr(" \t|&;<>", buffer[start - 1]) == NULL
+                             || (start > 1 && buffer[start - 2] == '\\')))
+                start--;
+        size_t before = start;
+        while (before > 0 && (buffer[before - 1] == ' ' || buffer[before - 1] == '\t'))
+                before--;
+        int isCommand = (before == 0 || strchr("|&;", buffer[before - 1]) != NULL);
+
+        char *prefix = malloc(editorCursor - start + 1);//with the backslashes removed
+        size_t prefixLength = 0;
+        for (size_t i = start; i < editorCursor; i++) {
+                if (buffer[i] == '\\' && i + 1 < editorCursor)
+                        i++;
+                prefix[prefixLength++] = buffer[i];
+        }
+        prefix[prefixLength] = '\0';
+
+        numCompletions = 0;
+        collectCompletions(prefix, isCommand && strchr(prefix, '/') == NULL);
+        if (numCompletions == 0) {
+                appendOutput("\a", 1);
+                free(prefix);
+                return;
+        }
+        size_t common = strlen(completions[0]);
+        for (int i = 1; i < numCompletions; i++) {
+                size_t same = 0;
+                while (same < common && completions[i][same] == completions[0][same])
+                        same++;
+                common = same;
+        }
+        if (common > prefixLength || numCompletions == 1) {
+                for (size_t i = prefixLength; i < common; i++) {
+                        char c = completions[0][i];
+                        if (strchr(" \t|&;<>'\"\\", c) != NULL)//keep it a single word
+                                insertText("\\", 1);
+                        insertText(&c, 1);
+                }
+                if (numCompletions == 1 && completions[0][common - 1] != '/')
+                        insertText(" ", 1);
+        } else if (editorLastKey == '\t') {//list the candidates under the line
+                leaveLine();
+                appendOutput("\n", 1);
+                for (int i = 0; i < numCompletions; i++) {
+                        appendOutput(completions[i], strlen(completions[i]));
+                        if (i + 1 < numCompletions)
+                                appendOutput("  ", 2);
+                }
+                appendOutput("\n", 1);
+                redrawPrompt();
+        } else {
+                appendOutput("\a", 1);
+        }
+        for (int i = 0; i < numCompletions; i++)
+                free(completions[i]);
+        free(prefix);
+}
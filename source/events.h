@@ -0,0 +1,291 @@
+/*Job event log and metrics. The shell records every job transition in
+eventRing, a single-producer single-consumer ring: only the main thread
+adds events and only eventWriter takes them, so neither ever waits for the
+other, and a full ring drops events instead of slowing the shell down.
+eventWriter appends them to MSH_EVENT_LOG as JSON lines, keeps the counters,
+and answers every connection to the Unix socket MSH_METRICS_SOCKET with them
+in the Prometheus text format. Nothing runs unless one of the two is set
+when the shell starts*/
+
+void startEventWriter()
+{
+        char *logPath = lookupVariable("MSH_EVENT_LOG");
+        char *socketPath = lookupVariable("MSH_METRICS_SOCKET");
+
+        if (logPath != NULL && *logPath != '\0') {
+                eventLog = open(logPath, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+                if (eventLog == -1)
+                        perror("MSH: MSH_EVENT_LOG");
+        }
+        if (socketPath != NULL && *socketPath != '\0') {
+                struct sockaddr_un address = { .sun_family = AF_UNIX };
+                if (strlen(socketPath) >= sizeof(address.sun_path)) {
+                        fprintf(stderr, "MSH: MSH_METRICS_SOCKET: path too long\n");
+                } else {
+                        strcpy(address.sun_path, socketPath);
+                        if (claimSocketPath(&address)) {
+                                metricsSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK
+                                                       | SOCK_CLOEXEC, 0);
+                                if (metricsSocket == -1
+                                    || bind(metricsSocket, (struct sockaddr*) &address,
+                                            sizeof(address)) == -1
+                                    || listen(metricsSocket, 16) == -1) {
+                                        perror("MSH: MSH_METRICS_SOCKET");
+                                        if (metricsSocket != -1)
+                                                close(metricsSocket);
+                                        metricsSocket = -1;
+                                } else {
+                                        metricsPath = strdup(socketPath);
+                                }
+                        }
+                }
+        }
+        if (eventLog == -1 && metricsSocket == -1)
+                return;
+        eventWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (eventWakeup == -1 || pthread_create(&eventWriter, NULL, writeEvents, NULL) != 0) {
+                perror("MSH: event log");
+                return;
+        }
+        eventsEnabled = TRUE;
+        eventWriterProcess = getpid();
+        atexit(stopEventWriter);
+}
+
+void stopEventWriter()//at exit, so the last events are not lost
+{
+        if (!eventsEnabled || getpid() != eventWriterProcess)
+                return;//a forked copy of the shell has no writer thread
+        uint64_t one = 1;
+        atomic_store_explicit(&eventWriterStopping, TRUE, memory_order_release);
+        write(eventWakeup, &one, sizeof(one));
+        pthread_join(eventWriter, NULL);
+        if (metricsPath != NULL)
+                unlink(metricsPath);//the one bound, whatever the variable holds now
+}
+
+int claimSocketPath(struct sockaddr_un* address)
+/*whether the metrics socket can be bound at address: nothing is there, or a
+socket left behind by a shell that is gone, which is removed. A file that is
+not a socket, or a socket another shell still answers on, is left alone*/
+{
+        struct stat info;
+        if (lstat(address->sun_path, &info) == -1)
+                return TRUE;
+        if (!S_ISSOCK(info.st_mode)) {
+                fprintf(stderr, "MSH: MSH_METRICS_SOCKET: %s is not a socket\n",
+                        address->sun_path);
+                return FALSE;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe == -1) {
+                perror("MSH: MSH_METRICS_SOCKET");
+                return FALSE;
+        }
+        int answered = connect(probe, (struct sockaddr*) address, sizeof(*address)) == 0;
+        close(probe);
+        if (answered) {
+                fprintf(stderr, "MSH: MSH_METRICS_SOCKET: %s is in use by another shell\n",
+                        address->sun_path);
+                return FALSE;
+        }
+        unlink(address->sun_path);
+        return TRUE;
+}
+
+void recordJobEvent(int type, t_job* job, pid_t pid, long latency)
+/*called by the main thread only. latency is how long a launch took, in ns.
+For EVENT_LAUNCH, a posix_spawn(), that is until the exec, as the parent
+only goes on once the child has exec()ed; an EVENT_FORK is done when fork()
+returned, before the child even started, so the two are kept apart*/
+{
+        if (!eventsEnabled)
+                return;
+        size_t head = atomic_load_explicit(&eventHead, memory_order_relaxed);
+        if (head - atomic_load_explicit(&eventTail, memory_order_acquire) == EVENT_RING_LENGTH) {
+                atomic_fetch_add_explicit(&eventsDropped, 1, memory_order_relaxed);
+                return;
+        }
+        t_jobEvent *event = &eventRing[head & (EVENT_RING_LENGTH - 1)];
+        clock_gettime(CLOCK_REALTIME, &event->time);
+        event->type = type;
+        event->jobId = job->id;
+        event->pgid = job->pgid;
+        event->pid = pid;
+        event->firstProcess = (pid == job->processes[0]);
+        event->termination = job->termination;
+        event->latency = latency;
+        event->usage = job->usage;
+        snprintf(event->name, sizeof(event->name), "%s", job->name);
+        atomic_store_explicit(&eventHead, head + 1, memory_order_release);
+        uint64_t one = 1;
+        write(eventWakeup, &one, sizeof(one));
+}
+
+void* writeEvents(void *unused)//the eventWriter thread
+{
+        struct pollfd descriptors[2] = { { eventWakeup, POLLIN, 0 }, { metricsSocket, POLLIN, 0 } };
+        char *line = NULL;
+        size_t lineLength = 0, lineCapacity = 0;
+        sigset_t signals;
+        uint64_t count;
+
+        (void) unused;//pthread_create() passes NULL
+        sigfillset(&signals);//signals are for the main thread
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        while (TRUE) {
+                if (poll(descriptors, metricsSocket == -1 ? 1 : 2, -1) == -1 && errno != EINTR)
+                        break;
+                read(eventWakeup, &count, sizeof(count));
+                size_t tail = atomic_load_explicit(&eventTail, memory_order_relaxed);
+                size_t head = atomic_load_explicit(&eventHead, memory_order_acquire);
+                lineLength = 0;
+                for (; tail != head; tail++) {
+                        t_jobEvent *event = &eventRing[tail & (EVENT_RING_LENGTH - 1)];
+                        countEvent(event);
+                        if (eventLog != -1)
+                                formatEvent(event, &line, &lineLength, &lineCapacity);
+                        atomic_store_explicit(&eventTail, tail + 1, memory_order_release);
+                }
+                if (lineLength > 0 && write(eventLog, line, lineLength) == -1) {
+                        close(eventLog);
+                        eventLog = -1;
+                }
+                if (metricsSocket != -1 && (descriptors[1].revents & POLLIN)) {
+                        int client;
+                        while ((client = accept4(metricsSocket, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+                                lineLength = 0;
+                                formatMetrics(&line, &lineLength, &lineCapacity);
+                                send(client, line, lineLength, MSG_NOSIGNAL | MSG_DONTWAIT);
+                                close(client);
+                        }
+                }
+                if (atomic_load_explicit(&eventWriterStopping, memory_order_acquire)
+                    && atomic_load_explicit(&eventHead, memory_order_acquire) == tail)
+                        break;
+        }
+        free(line);
+        return NULL;
+}
+
+void countEvent(t_jobEvent* event)//updates the counters, in the writer thread
+{
+        if (event->type == EVENT_LAUNCH || event->type == EVENT_FORK) {
+                time_t second = event->time.tv_sec;
+                t_launchBucket *bucket = &launchBuckets[second % LAUNCH_RATE_SECONDS];
+                if (bucket->second != second) {
+                        bucket->second = second;
+                        bucket->launches = 0;
+                }
+                bucket->launches++;
+                launchesTotal++;
+                int forked = event->type == EVENT_FORK;
+                launchLatencies[forked][numLaunchLatencies[forked]++ % LAUNCH_LATENCY_SAMPLES] =
+                        event->latency;
+                if (event->firstProcess)
+                        jobsStarted++;
+        } else if (event->type == EVENT_EXIT || event->type == EVENT_SIGNAL) {
+                jobsFinished++;
+        }
+}
+
+void formatEvent(t_jobEvent* event, char **line, size_t *length, size_t *capacity)
+/*one JSON object per line*/
+{
+        static const char *types[] = {
+                "launch", "exit", "signal", "stop", "continue", "foreground", "background",
+                "launch"
+        };
+        char field[256];
+        int status = event->type == EVENT_EXIT ? WEXITSTATUS(event->termination) :
+                     event->type == EVENT_SIGNAL ? WTERMSIG(event->termination) : 0;
+
+        snprintf(field, sizeof(field), "{\"time\": %ld.%09ld, \"event\": \"%s\", \"job\": %d, "
+                 "\"pgid\": %d, \"pid\": %d, \"name\": ", (long) event->time.tv_sec,
+                 event->time.tv_nsec, types[event->type], event->jobId, (int) event->pgid,
+                 (int) event->pid);
+        appendBytes(line, length, capacity, field, strlen(field));
+        appendJsonString(line, length, capacity, event->name);
+        if (event->type == EVENT_LAUNCH || event->type == EVENT_FORK)
+                snprintf(field, sizeof(field), ", \"launcher\": \"%s\", \"latency\": %.9f}\n",
+                         event->type == EVENT_FORK ? "fork" : "spawn", event->latency / 1e9);
+        else if (event->type == EVENT_EXIT || event->type == EVENT_SIGNAL)
+                snprintf(field, sizeof(field), ", \"%s\": %d, \"utime\": %ld.%06ld, "
+                         "\"stime\": %ld.%06ld, \"maxrss\": %ld}\n",
+                         event->type == EVENT_EXIT ? "status" : "signal", status,
+                         (long) event->usage.ru_utime.tv_sec, (long) event->usage.ru_utime.tv_usec,
+                         (long) event->usage.ru_stime.tv_sec, (long) event->usage.ru_stime.tv_usec,
+                         event->usage.ru_maxrss);
+        else
+                strcpy(field, "}\n");
+        appendBytes(line, length, capacity, field, strlen(field));
+}
+
+void formatMetrics(char **text, size_t *length, size_t *capacity)
+/*the counters in the Prometheus text format. Launch latencies are labelled
+by launcher, as they do not measure the same thing*/
+{
+        static const char *launchers[] = { "spawn", "fork" };
+        char metrics[1024];
+        struct timespec now;
+        long recent = 0;
+        long sorted[LAUNCH_LATENCY_SAMPLES];
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        for (int i = 0; i < LAUNCH_RATE_SECONDS; i++)//the last full seconds only
+                if (launchBuckets[i].second < now.tv_sec
+                    && launchBuckets[i].second >= now.tv_sec - LAUNCH_RATE_SECONDS)
+                        recent += launchBuckets[i].launches;
+        snprintf(metrics, sizeof(metrics),
+                 "# TYPE msh_launches_total counter\nmsh_launches_total %ld\n"
+                 "# TYPE msh_launches_per_second gauge\nmsh_launches_per_second %.3f\n"
+                 "# TYPE msh_launch_latency_seconds summary\n",
+                 launchesTotal, recent / (double) LAUNCH_RATE_SECONDS);
+        appendBytes(text, length, capacity, metrics, strlen(metrics));
+        for (int forked = 0; forked < 2; forked++) {
+                long numSamples = numLaunchLatencies[forked] < LAUNCH_LATENCY_SAMPLES ?
+                                  numLaunchLatencies[forked] : LAUNCH_LATENCY_SAMPLES;
+                memcpy(sorted, launchLatencies[forked], numSamples * sizeof(long));
+                qsort(sorted, numSamples, sizeof(long), compareLongs);
+                snprintf(metrics, sizeof(metrics),
+                         "msh_launch_latency_seconds{launcher=\"%s\",quantile=\"0.5\"} %.9f\n"
+                         "msh_launch_latency_seconds{launcher=\"%s\",quantile=\"0.99\"} %.9f\n"
+                         "msh_launch_latency_seconds_count{launcher=\"%s\"} %ld\n",
+                         launchers[forked], numSamples ? sorted[numSamples / 2] / 1e9 : 0.0,
+                         launchers[forked], numSamples ? sorted[numSamples * 99 / 100] / 1e9 : 0.0,
+                         launchers[forked], numLaunchLatencies[forked]);
+                appendBytes(text, length, capacity, metrics, strlen(metrics));
+        }
+        snprintf(metrics, sizeof(metrics),
+                 "# TYPE msh_active_jobs gauge\nmsh_active_jobs %ld\n"
+                 "# TYPE msh_events_dropped_total counter\nmsh_events_dropped_total %ld\n",
+                 jobsStarted - jobsFinished,
+                 atomic_load_explicit(&eventsDropped, memory_order_relaxed));
+        appendBytes(text, length, capacity, metrics, strlen(metrics));
+}
+
+void appendJsonString(char **data, size_t *length, size_t *capacity, const char *text)
+/*text as a quoted JSON string*/
+{
+        char escape[8];
+        appendBytes(data, length, capacity, "\"", 1);
+        for (const char *c = text; *c != '\0'; c++) {
+                if (*c == '"' || *c == '\\') {
+                        escape[0] = '\\';
+                        escape[1] = *c;
+                        appendBytes(data, length, capacity, escape, 2);
+                } else if ((unsigned char) *c < 0x20) {
+                        snprintf(escape, sizeof(escape), "\\u%04x", *c);
+                        appendBytes(data, length, capacity, escape, 6);
+                } else {
+                        appendBytes(data, length, capacity, c, 1);
+                }
+        }
+        appendBytes(data, length, capacity, "\"", 1);
+}
+
+int compareLongs(const void *first, const void *second)//for qsort()
+{
+        long a = *(const long*) first, b = *(const long*) second;
+        return (a > b) - (a < b);
+}
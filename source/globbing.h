@@ -0,0 +1,390 @@
+/*Pathname expansion. The lexer puts GLOB_MARK in front of every *, ? and [
+it finds unquoted; when the command runs, a word with marks is replaced by
+the paths it matches, sorted, or kept as it is if there are none. ** as a
+whole name matches any number of directories, except hidden ones and links.
+Directories are listed with scanDirectory() and the listings kept by path:
+within one command line they are trusted, after that listed again only once
+their inode or mtime changed. The directories under a ** are walked by a few
+threads at once, as one of them waiting on a slow disk or mount would
+otherwise hold up the rest*/
+
+void globWord(char *word, int *argc)//adds what word matches to the parser's arguments
+{
+        t_globMatches matches = { NULL, 0, 0 };
+
+        if (!isPattern(word)) {
+                addArgument(argc, removeGlobMarks(word));
+                return;
+        }
+        if (globCacheCount > GLOB_CACHE_LIMIT)
+                clearGlobCache();
+        const char *pattern = word;
+        while (*pattern == '/')
+                pattern++;
+        globPath(pattern == word ? "" : "/", pattern, &matches, TRUE);
+        for (int i = 0; i < numRetiredListings; i++) {//no walk is using them now
+                freeListing(retiredListings[i]);
+                free(retiredListings[i]);
+        }
+        numRetiredListings = 0;
+        if (matches.count == 0) {
+                addArgument(argc, removeGlobMarks(word));
+                return;
+        }
+        qsort(matches.paths, matches.count, sizeof(char*), compareStrings);
+        for (int i = 0; i < matches.count; i++) {
+                addArgument(argc, arenaCopy(matches.paths[i], strlen(matches.paths[i])));
+                free(matches.paths[i]);
+        }
+        free(matches.paths);
+}
+
+int isPattern(const char *word)//whether a *, ? or [ in word was marked
+{
+        for (const char *c = strchr(word, GLOB_MARK); c != NULL; c = strchr(c + 2, GLOB_MARK))
+                if (c[1] != GLOB_MARK)
+                        return TRUE;
+        return FALSE;
+}
+
+char* removeGlobMarks(char *word)//in place, leaving one of a doubled mark
+{
+        char *from = strchr(word, GLOB_MARK), *to = from;
+        if (from == NULL)
+                return word;
+        while (*from != '\0') {
+                if (*from == GLOB_MARK)
+                        from++;
+                if (*from != '\0')
+                        *to++ = *from++;
+        }
+        *to = '\0';
+        return word;
+}
+
+void globPath(const char *base, const char *pattern, t_globMatches* matches, int parallel)
+/*matches the names in pattern one after the other, starting in the directory
+base: "" for the current one, or a path ending in /. parallel lets a ** walk
+take threads; it is off inside one*/
+{
+        static const char anything[] = { GLOB_MARK, '*', '\0' };
+        static const char anyDirectory[] = { GLOB_MARK, '*', '/', '\0' };
+        size_t length = strcspn(pattern, "/");
+        const char *rest = pattern + length;
+        int directoriesOnly = (*rest == '/');//dir*/ matches directories alone
+        char name[length + 1];
+
+        while (*rest == '/')
+                rest++;
+        if (length == 4 && pattern[0] == GLOB_MARK && pattern[1] == '*'
+            && pattern[2] == GLOB_MARK && pattern[3] == '*') {
+                if (*rest == '\0')//as a last name, ** is everything below base
+                        rest = directoriesOnly ? anyDirectory : anything;
+                globDirectories(base, rest, matches, parallel);
+                return;
+        }
+        memcpy(name, pattern, length);
+        name[length] = '\0';
+        if (!isPattern(name)) {//no need to list the directory for it
+                struct stat info;
+                removeGlobMarks(name);
+                char path[strlen(base) + strlen(name) + 2];
+                sprintf(path, "%s%s", base, name);
+                if (*rest != '\0') {
+                        strcat(path, "/");
+                        globPath(path, rest, matches, parallel);
+                } else if (lstat(path, &info) == 0 && (!directoriesOnly
+                           || (stat(path, &info) == 0 && S_ISDIR(info.st_mode)))) {
+                        addGlobMatch(matches, base, name, directoriesOnly);
+                }
+                return;
+        }
+        t_directoryListing *listing = cachedListing(base);
+        for (int i = 0; i < listing->numEntries; i++) {
+                t_listedName *entry = &listing->entries[i];
+                if ((entry->name[0] == '.' && name[0] != '.')//hidden unless asked for
+                    || !matchPattern(name, entry->name))
+                        continue;
+                if (*rest != '\0') {
+                        if (!entry->isDirectory)
+                                continue;
+                        char path[strlen(base) + strlen(entry->name) + 2];
+                        sprintf(path, "%s%s/", base, entry->name);
+                        globPath(path, rest, matches, parallel);
+                } else if (!directoriesOnly || entry->isDirectory) {
+                        addGlobMatch(matches, base, entry->name, directoriesOnly);
+                }
+        }
+}
+
+void globDirectories(const char *base, const char *rest, t_globMatches* matches, int parallel)
+/*matches rest in base and every directory below it*/
+{
+        if (!parallel) {
+                globPath(base, rest, matches, FALSE);
+                t_directoryListing *listing = cachedListing(base);
+                for (int i = 0; i < listing->numEntries; i++) {
+                        t_listedName *entry = &listing->entries[i];
+                        if (!entry->isDirectory || entry->isLink || entry->name[0] == '.')
+                                continue;
+                        char path[strlen(base) + strlen(entry->name) + 2];
+                        sprintf(path, "%s%s/", base, entry->name);
+                        globDirectories(path, rest, matches, FALSE);
+                }
+                return;
+        }
+        t_globWalk walk = { .rest = rest };
+        t_globWorker workers[GLOB_THREADS];
+        sigset_t signals, shellSignals;
+        int numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (numWorkers > GLOB_THREADS)
+                numWorkers = GLOB_THREADS;
+        if (numWorkers < 1)
+                numWorkers = 1;
+        pthread_mutex_init(&walk.lock, NULL);
+        pthread_cond_init(&walk.changed, NULL);
+        walk.directoriesCapacity = 64;
+        walk.directories = malloc(walk.directoriesCapacity * sizeof(char*));
+        walk.directories[walk.numDirectories++] = strdup(base);
+        /*the shell's own thread is workers[0]. The others start with every
+        signal blocked, signals are for the shell's*/
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, &shellSignals);
+        for (int i = 0; i < numWorkers; i++) {
+                workers[i].walk = &walk;
+                workers[i].matches = (t_globMatches) { NULL, 0, 0 };
+                if (i > 0 && pthread_create(&workers[i].thread, NULL, walkDirectories,
+                                            &workers[i]) != 0)
+                        numWorkers = i;
+        }
+        pthread_sigmask(SIG_SETMASK, &shellSignals, NULL);
+        walkDirectories(&workers[0]);
+        for (int i = 0; i < numWorkers; i++) {
+                if (i > 0)
+                        pthread_join(workers[i].thread, NULL);
+                t_globMatches *found = &workers[i].matches;
+                if (found->count == 0)
+                        continue;
+                matches->capacity = matches->count + found->count;
+                matches->paths = realloc(matches->paths, matches->capacity * sizeof(char*));
+                memcpy(matches->paths + matches->count, found->paths, found->count * sizeof(char*));
+                matches->count += found->count;
+                free(found->paths);
+        }
+        free(walk.directories);
+        pthread_mutex_destroy(&walk.lock);
+        pthread_cond_destroy(&walk.changed);
+}
+
+void* walkDirectories(void *argument)
+/*takes directories off the walk until there are none left and no other
+thread is listing one that may have more below it*/
+{
+        t_globWorker *worker = argument;
+        t_globWalk *walk = worker->walk;
+
+        pthread_mutex_lock(&walk->lock);
+        while (TRUE) {
+                while (walk->numDirectories == 0 && walk->busy > 0)
+                        pthread_cond_wait(&walk->changed, &walk->lock);
+                if (walk->numDirectories == 0)
+                        break;
+                char *directory = walk->directories[--walk->numDirectories];
+                walk->busy++;
+                pthread_mutex_unlock(&walk->lock);
+
+                globPath(directory, walk->rest, &worker->matches, FALSE);
+                t_directoryListing *listing = cachedListing(directory);
+
+                pthread_mutex_lock(&walk->lock);
+                for (int i = 0; i < listing->numEntries; i++) {
+                        t_listedName *entry = &listing->entries[i];
+                        if (!entry->isDirectory || entry->isLink || entry->name[0] == '.')
+                                continue;
+                        if (walk->numDirectories == walk->directoriesCapacity) {
+                                walk->directoriesCapacity *= 2;
+                                walk->directories = realloc(walk->directories,
+                                                            walk->directoriesCapacity
+                                                            * sizeof(char*));
+                        }
+                        char *path = malloc(strlen(directory) + strlen(entry->name) + 2);
+                        sprintf(path, "%s%s/", directory, entry->name);
+                        walk->directories[walk->numDirectories++] = path;
+                }
+                walk->busy--;
+                pthread_cond_broadcast(&walk->changed);
+                free(directory);
+        }
+        pthread_mutex_unlock(&walk->lock);
+        return NULL;
+}
+
+void addGlobMatch(t_globMatches* matches, const char *base, const char *name, int slash)
+{
+        if (matches->count == matches->capacity) {
+                matches->capacity = matches->capacity ? 2 * matches->capacity : 64;
+                matches->paths = realloc(matches->paths, matches->capacity * sizeof(char*));
+        }
+        char *path = malloc(strlen(base) + strlen(name) + 2);
+        sprintf(path, "%s%s%s", base, name, slash ? "/" : "");
+        matches->paths[matches->count++] = path;
+}
+
+int matchPattern(const char *pattern, const char *name)
+/*whether name matches pattern, where only marked *, ? and [ are special. A
+* first matches nothing and takes one more character each time the rest of
+the pattern fails*/
+{
+        const char *star = NULL, *starName = NULL;
+        int length;
+
+        while (*name != '\0') {
+                if (pattern[0] == GLOB_MARK && pattern[1] == '*') {
+                        star = pattern += 2;
+                        starName = name;
+                        continue;
+                }
+                if (pattern[0] == GLOB_MARK && pattern[1] == '?') {
+                        pattern += 2;
+                        name++;
+                        continue;
+                }
+                if (pattern[0] == GLOB_MARK && pattern[1] == '['
+                    && (length = bracketLength(pattern + 2)) > 0) {
+                        if (matchBracket(pattern + 2, *name)) {
+                                pattern += 2 + length;
+                                name++;
+                                continue;
+                        }
+                } else {//a [ without its ] is an ordinary character
+                        const char *literal = pattern + (pattern[0] == GLOB_MARK);
+                        if (*literal != '\0' && *literal == *name) {
+                                pattern = literal + 1;
+                                name++;
+                                continue;
+                        }
+                }
+                if (star == NULL)
+                        return FALSE;
+                pattern = star;
+                name = ++starName;
+        }
+        while (pattern[0] == GLOB_MARK && pattern[1] == '*')
+                pattern += 2;
+        return *pattern == '\0';
+}
+
+int bracketLength(const char *pattern)
+/*the length of the [...] after the [ at pattern, up to and with the ], 0
+if there is no ]. A ] right after [ or [! is one of the characters*/
+{
+        const char *c = pattern;
+        if (*c == '!' || *c == '^')
+                c++;
+        if (*c == ']')
+                c++;
+        for (; *c != '\0' && *c != ']'; c++)
+                if (*c == GLOB_MARK && c[1] != '\0')
+                        c++;
+        return *c == ']' ? (int) (c - pattern + 1) : 0;
+}
+
+int matchBracket(const char *pattern, char c)//whether c is one of [...] or a range in it
+{
+        int negated = (*pattern == '!' || *pattern == '^');
+        int matched = FALSE;
+        const char *next = pattern + negated;
+
+        do {
+                if (*next == GLOB_MARK)
+                        next++;
+                unsigned char low = *next++, high = low;
+                if (*next == '-' && next[1] != ']' && next[1] != '\0') {
+                        next++;
+                        if (*next == GLOB_MARK)
+                                next++;
+                        high = *next++;
+                }
+                if ((unsigned char) c >= low && (unsigned char) c <= high)
+                        matched = TRUE;
+        } while (*next != ']');
+        return matched != negated;
+}
+
+t_directoryListing* cachedListing(const char *base)
+/*the listing of the directory base, "" being the current one. Listings are
+never changed once made: a fresh one replaces an old, which is only freed
+after the walk, as another thread may still be reading it*/
+{
+        const char *path = *base ? base : ".";
+
+        pthread_mutex_lock(&globLock);
+        t_cachedListing *slot = findCachedListing(path);
+        t_directoryListing *listing = slot->listing;
+        unsigned long checkedLine = slot->checkedLine;
+        pthread_mutex_unlock(&globLock);
+        if (listing != NULL && checkedLine == globLine)
+                return listing;
+        if (listing == NULL || listingChanged(listing)) {
+                listing = calloc(1, sizeof(t_directoryListing));
+                listing->path = strdup(path);
+                scanDirectory(listing, FALSE);
+        }
+
+        pthread_mutex_lock(&globLock);
+        if (2 * (globCacheCount + 1) > globCacheCapacity) {
+                t_cachedListing *oldCache = globCache;
+                int oldCapacity = globCacheCapacity;
+                globCacheCapacity = oldCapacity ? 2 * oldCapacity : 64;
+                globCache = calloc(globCacheCapacity, sizeof(t_cachedListing));
+                for (int i = 0; i < oldCapacity; i++)
+                        if (oldCache[i].listing != NULL)
+                                *findCachedListing(oldCache[i].listing->path) = oldCache[i];
+                free(oldCache);
+        }
+        slot = findCachedListing(path);//where it is may have moved meanwhile
+        if (slot->listing == NULL) {
+                globCacheCount++;
+        } else if (slot->listing != listing) {
+                if (numRetiredListings == retiredListingsCapacity) {
+                        retiredListingsCapacity = retiredListingsCapacity ?
+                                                  2 * retiredListingsCapacity : 16;
+                        retiredListings = realloc(retiredListings, retiredListingsCapacity
+                                                  * sizeof(t_directoryListing*));
+                }
+                retiredListings[numRetiredListings++] = slot->listing;
+        }
+        slot->listing = listing;
+        slot->checkedLine = globLine;
+        pthread_mutex_unlock(&globLock);
+        return listing;
+}
+
+t_cachedListing* findCachedListing(const char *path)
+/*the slot holding the listing of path, or the empty slot where it would go*/
+{
+        static t_cachedListing none;
+        if (globCacheCapacity == 0)
+                return &none;
+        unsigned int hash = 5381;
+        for (const char *c = path; *c != '\0'; c++)
+                hash = hash * 33 + (unsigned char) *c;
+        unsigned int mask = globCacheCapacity - 1;
+        unsigned int slot = hash & mask;
+        while (globCache[slot].listing != NULL && strcmp(globCache[slot].listing->path, path) != 0)
+                slot = (slot + 1) & mask;
+        return &globCache[slot];
+}
+
+void clearGlobCache()
+{
+        for (int i = 0; i < globCacheCapacity; i++) {
+                if (globCache[i].listing != NULL) {
+                        freeListing(globCache[i].listing);
+                        free(globCache[i].listing);
+                }
+        }
+        memset(globCache, 0, globCacheCapacity * sizeof(t_cachedListing));
+        globCacheCount = 0;
+}
@@ -0,0 +1,231 @@
+/*Command history. It is kept in an append-only file of records, each one a
+t_historyHeader followed by the text of a line. At startup the file is
+mmap()ed and only the record headers are walked to index the entries, so
+even a very long history is loaded without being read or parsed line by
+line. Every shell adds its lines with a single write() on an O_APPEND
+descriptor, which the kernel never interleaves with another shell's record*/
+
+void loadHistory()
+{
+        char *path = lookupVariable("MSH_HISTFILE");
+        char *home = lookupVariable("HOME");
+        char defaultPath[PATH_MAX];
+        struct stat info;
+        t_historyHeader header;
+
+        if (path == NULL) {
+                if (home == NULL)
+                        return;//no history without a place to keep it
+                snprintf(defaultPath, sizeof(defaultPath), "%s/.msh_history", home);
+                path = defaultPath;
+        }
+        historyDescriptor = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (historyDescriptor == -1 || fstat(historyDescriptor, &info) == -1
+            || info.st_size == 0)
+                return;
+        historyMap = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, historyDescriptor, 0);
+        if (historyMap == MAP_FAILED) {
+                historyMap = NULL;
+                return;
+        }
+        historyMapLength = info.st_size;
+
+        /*A record is taken if its header is whole and the next record, if
+        any, starts where its length says. Otherwise it was cut short by a
+        shell that died while writing it, and the search for the next
+        marker starts from inside it: that text is only read then*/
+        size_t offset = 0;
+        while (offset + sizeof(header) <= historyMapLength) {
+                memcpy(&header, historyMap + offset, sizeof(header));
+                size_t left = historyMapLength - offset - sizeof(header);
+                size_t end = offset + sizeof(header) + header.length;
+                if (memcmp(header.marker, HISTORY_MARKER, 4) == 0
+                    && header.check == ~header.length && header.length <= left
+                    && memcmp(historyMap + end, HISTORY_MARKER,
+                              historyMapLength - end < 4 ? historyMapLength - end : 4) == 0) {
+                        addHistoryEntry(historyMap + offset + sizeof(header), header.length);
+                        offset = end;
+                        continue;
+                }
+                char *next = memmem(historyMap + offset + 1, historyMapLength - offset - 1,
+                                    HISTORY_MARKER, 4);
+                if (next == NULL)
+                        break;
+                offset = next - historyMap;
+        }
+}
+
+void addHistoryEntry(char *text, uint32_t length)//to the in-memory index only
+{
+        if (numHistoryEntries == historyEntriesCapacity) {
+                historyEntriesCapacity = historyEntriesCapacity ?
+                                         2 * historyEntriesCapacity : 1024;
+                historyEntries = realloc(historyEntries,
+                                         historyEntriesCapacity * sizeof(t_historyEntry));
+        }
+        historyEntries[numHistoryEntries].text = text;
+        historyEntries[numHistoryEntries].length = length;
+        numHistoryEntries++;
+}
+
+void addHistory(char *line, size_t length)//a line typed in this session
+{
+        char *c = line;
+        while (*c == ' ' || *c == '\t')
+                c++;
+        if (*c == '\0' || length > UINT32_MAX)
+                return;
+        if (numHistoryEntries > 0) {//like ignoredups in other shells
+                t_historyEntry *last = &historyEntries[numHistoryEntries - 1];
+                if (last->length == length && memcmp(last->text, line, length) == 0)
+                        return;
+        }
+        t_historyHeader header = { HISTORY_MARKER, (uint32_t) length, ~(uint32_t) length };
+        if (historyDescriptor != -1) {
+                struct iovec record[2] = { { &header, sizeof(header) }, { line, length } };
+                if (writev(historyDescriptor, record, 2) == -1) {
+                        perror("MSH: history");
+                        close(historyDescriptor);
+                        historyDescriptor = -1;
+                }
+        }
+        char *text = malloc(length);
+        memcpy(text, line, length);
+        addHistoryEntry(text, header.length);
+}
+
+int expandHistory()
+/*replaces !!, !n and !-n in buffer with the entries they name, outside of
+single quotes, and shows the line that results. Returns FALSE if one does not
+exist; the line is then dropped*/
+{
+        int singleQuoted = FALSE, doubleQuoted = FALSE, expanded = FALSE;
+
+        if (strchr(buffer, '!') == NULL)
+                return TRUE;
+        wordLength = 0;
+        for (char *c = buffer; *c != '\0'; c++) {
+                if (*c == '\'' && !doubleQuoted)
+                        singleQuoted = !singleQuoted;
+                else if (*c == '"' && !singleQuoted)
+                        doubleQuoted = !doubleQuoted;
+                if (*c == '\\' && !singleQuoted && c[1] != '\0') {
+                        appendToWord(*c++);
+                        appendToWord(*c);
+                        continue;
+                }
+                int isEvent = *c == '!' && !singleQuoted
+                              && (c[1] == '!' || (c[1] >= '0' && c[1] <= '9')
+                                  || (c[1] == '-' && c[2] >= '0' && c[2] <= '9'));
+                if (!isEvent) {
+                        appendToWord(*c);
+                        continue;
+                }
+                char *end = c + 2;
+                long number = numHistoryEntries;//!!
+                if (c[1] != '!') {
+                        number = strtol(c + 1, &end, 10);
+                        if (number < 0)//!-n counts back from the last entry
+                                number += numHistoryEntries + 1;
+                }
+                if (number < 1 || number > numHistoryEntries) {
+                        fprintf(stderr, "MSH: %.*s: event not found\n", (int) (end - c), c);
+                        return FALSE;
+                }
+                t_historyEntry *entry = &historyEntries[number - 1];
+                for (uint32_t i = 0; i < entry->length; i++)
+                        appendToWord(entry->text[i]);
+                c = end - 1;
+                expanded = TRUE;
+        }
+        if (!expanded)
+                return TRUE;
+        if (wordLength + 1 > bufferCapacity) {
+                bufferCapacity = wordLength + 1;
+                buffer = realloc(buffer, bufferCapacity);
+        }
+        memcpy(buffer, wordBuffer, wordLength);
+        buffer[wordLength] = '\0';
+        bufferChars = wordLength;
+        printf("%s\n", buffer);
+        return TRUE;
+}
+
+void printHistory(int count)//history [n]: the last n entries, all by default
+{
+        int first = count > 0 && count < numHistoryEntries ? numHistoryEntries - count : 0;
+        for (int i = first; i < numHistoryEntries; i++)
+                printHistoryEntry(i);
+}
+
+void searchHistory(char *pattern)
+/*history -s text: every entry containing text. With three characters or
+more, only the blocks of entries the index leaves are looked at. The index
+is made at the first search, not at startup, and grows with the entries*/
+{
+        size_t patternLength = strlen(pattern);
+        unsigned buckets[64];
+        int numBuckets = 0;
+
+        if (patternLength < 3) {
+                for (int i = 0; i < numHistoryEntries; i++)
+                        if (memmem(historyEntries[i].text, historyEntries[i].length, pattern,
+                                   patternLength) != NULL)
+                                printHistoryEntry(i);
+                return;
+        }
+        indexHistory();
+        /*trigrams spread over the text narrow it down the most*/
+        for (size_t i = 0; i + 3 <= patternLength && numBuckets < 64;
+             i += patternLength / 64 + 1)
+                buckets[numBuckets++] = trigramBucket(pattern + i);
+        for (size_t word = 0; word < historyIndexWords; word++) {
+                uint64_t blocks = ~(uint64_t) 0;
+                for (int j = 0; j < numBuckets && blocks != 0; j++)
+                        blocks &= historyIndex[buckets[j] * historyIndexWords + word];
+                while (blocks != 0) {
+                        int first = (int) (word * 64 + __builtin_ctzll(blocks)) * HISTORY_BLOCK;
+                        blocks &= blocks - 1;
+                        for (int i = first; i < first + HISTORY_BLOCK && i < numHistoryEntries; i++)
+                                if (memmem(historyEntries[i].text, historyEntries[i].length,
+                                           pattern, patternLength) != NULL)
+                                        printHistoryEntry(i);
+                }
+        }
+}
+
+void indexHistory()//adds the entries not in historyIndex yet
+{
+        size_t wordsNeeded = (numHistoryEntries / HISTORY_BLOCK) / 64 + 1;
+        if (wordsNeeded > historyIndexWords) {//every row gets longer
+                size_t words = historyIndexWords ? 2 * historyIndexWords : 16;
+                while (words < wordsNeeded)
+                        words *= 2;
+                uint64_t *index = calloc(HISTORY_BUCKETS * words, sizeof(uint64_t));
+                for (size_t row = 0; row < HISTORY_BUCKETS && historyIndex != NULL; row++)
+                        memcpy(index + row * words, historyIndex + row * historyIndexWords,
+                               historyIndexWords * sizeof(uint64_t));
+                free(historyIndex);
+                historyIndex = index;
+                historyIndexWords = words;
+        }
+        for (; numIndexedEntries < numHistoryEntries; numIndexedEntries++) {
+                t_historyEntry *entry = &historyEntries[numIndexedEntries];
+                size_t block = numIndexedEntries / HISTORY_BLOCK;
+                for (uint32_t i = 0; i + 3 <= entry->length; i++)
+                        historyIndex[trigramBucket(entry->text + i) * historyIndexWords
+                                     + block / 64] |= (uint64_t) 1 << (block % 64);
+        }
+}
+
+unsigned trigramBucket(const char *text)//of the three characters at text
+{
+        uint32_t trigram = (unsigned char) text[0] | (unsigned char) text[1] << 8
+                           | (unsigned char) text[2] << 16;
+        return (trigram * 2654435761u) >> 20 & (HISTORY_BUCKETS - 1);
+}
+
+void printHistoryEntry(int i)
+{
+        printf("%5d  %.*s\n", i + 1, (int) historyEntries[i].length, historyEntries[i].text);
+}
@@ -1,68 +1,123 @@
 /*The main file that needs to be compiled.Will work in Linux OS only*/
+#define _GNU_SOURCE//for pipe2(), signalfd() and friends
 #include <stdio.h>
 /*header file containing declarations of functions, macros, struct and other liberary
 files containing system calls used*/
 #include "declarations.h"
 /*definations of user defined functions*/
 #include "utilities.h"
+/*the command line lexer and parser*/
+#include "parser.h"
+/*persistent command history*/
+#include "history.h"
+/*the interactive line editor*/
+#include "editor.h"
+/*what Tab completes to*/
+#include "completion.h"
+/*the prompt*/
+#include "prompt.h"
+/*shell variables and their expansion*/
+#include "variables.h"
+/*the job event log and metrics*/
+#include "events.h"
+/*pathname expansion*/
+#include "globbing.h"
+/*$(command) and `command`*/
+#include "substitution.h"
+/*limit: cgroup v2 and setrlimit() limits for jobs*/
+#include "resources.h"
 #define MAXLINE 4096
 int main(int argc, char **argv, char **envp)
 {
+        importEnvironment(envp);//the first shell variables, all exported
+        parseArguments(argc, argv);//msh -c 'command' or msh script
         init();//begins initializationof mini-shell, see utilities.h
-        welcomeScreen();//screen to be displayed when mini shell starts
-        shellPrompt();//set the prompt of the shell
+        if (MSH_IS_INTERACTIVE)
+                welcomeScreen();//screen to be displayed when mini shell starts
         /*Enter an infinite loop*/
 		while (TRUE) {
-                userInput = getchar();
-                switch (userInput) {
-                case '\n'://if user presses ENTER key
-                        shellPrompt();
+                if (MSH_IS_INTERACTIVE)
+                        numFinishedJobs = 0;//their Done was shown at the last prompt
+                handleChildEvents();//report jobs that changed state meanwhile
+                if (MSH_IS_INTERACTIVE)
+                        shellPrompt();//set the prompt of the shell
+                if (getTextLine() == EOF)//accept command from user
                         break;
-                default:
-                        getTextLine();//accept command from user
-                        handleUserCommand();//handles the command obtained 
-                        shellPrompt();
-                        break;
-                }
+                if (commandLine == NULL)//an empty line, or a syntax error already reported
+                        continue;
+                handleUserCommand();//handles the command obtained 
         }
-        printf("\n");
-        return 0;
+        if (MSH_IS_INTERACTIVE)
+                printf("\n");
+        return lastExitStatus;
 }
 
-void signalHandler_child(int p)//Signal handler for SIGCHLD
+void handleChildEvents()//reaps every child whose state changed since the last call
 {
         pid_t pid;
         int terminationStatus;
-        pid = waitpid(WAIT_ANY, &terminationStatus, WUNTRACED | WNOHANG);
-        if (pid > 0) {
+        struct rusage usage;
+        struct signalfd_siginfo info;
+        /*Drain the pending SIGCHLD notifications first; a child changing state
+        after the waitpid() loop below leaves a fresh one behind, so no event
+        can be lost between two calls*/
+        while (read(MSH_CHILD_FD, &info, sizeof(info)) == sizeof(info))
+                if (info.ssi_signo == SIGINT)//see runParallel()
+                        MSH_INTERRUPTED = TRUE;
+        /*wait4() also hands back the resources used by the reaped child,
+        which are added up for the whole job*/
+        while ((pid = wait4(WAIT_ANY, &terminationStatus,
+                            WUNTRACED | WCONTINUED | WNOHANG, &usage)) > 0) {
                 t_job* job = getJob(pid, BY_PROCESS_ID);
                 if (job == NULL)
-                        return;
-                if (WIFEXITED(terminationStatus)) {
-                        if (job->status == BACKGROUND) {
-                                printf("\n[%d]+  Done\t   %s\n", job->id, job->name);
-                                jobsList = delJob(job);
+                        continue;
+                if (WIFEXITED(terminationStatus) || WIFSIGNALED(terminationStatus)) {
+                        /*A pipeline is finished once all of its stages are,
+                        and like in other shells its last stage decides how*/
+                        if (pid == job->processes[job->numProcesses - 1])
+                                job->termination = terminationStatus;
+                        addUsage(&job->usage, &usage);
+                        removeJobProcess(job, pid);
+                        if (job->runningProcesses > 0)
+                                continue;
+                        recordJobEvent(WIFSIGNALED(job->termination) ? EVENT_SIGNAL : EVENT_EXIT,
+                                       job, pid, 0);
+                        if (job->id <= numWaitSlots && waitSlots[job->id - 1].waited)
+                                finishWait(job, jobExitStatus(job->termination));//see waitJobs()
+                        else if (job->status != FOREGROUND && job->taskIndex < 0)
+                                keepFinishedJob(job);
+                        if (job->status == FOREGROUND) {//the status $? would report
+                                lastExitStatus = jobExitStatus(job->termination);
+                                lastForegroundUsage = job->usage;//for the time builtin
+                                lastForegroundWall = secondsSince(&job->started);
+                                lastForegroundFinished = TRUE;
                         }
-                } else if (WIFSIGNALED(terminationStatus)) {
-                        printf("\n[%d]+  KILLED\t   %s\n", job->id, job->name);
-                        jobsList = delJob(job);
+                        if (job->taskIndex >= 0)
+                                finishParallelTask(job);//reports the task itself
+                        else if (!MSH_IS_INTERACTIVE)
+                                ;//scripts do not report job notifications
+                        else if (WIFSIGNALED(job->termination))
+                                printf("\n[%d]+  KILLED\t   %s\n", job->id, job->name);
+                        else if (job->status == BACKGROUND)
+                                printf("\n[%d]+  Done\t   %s\n", job->id, job->name);
+                        delJob(job);
                 } else if (WIFSTOPPED(terminationStatus)) {
+                        recordJobEvent(EVENT_STOP, job, pid, 0);
+                        job->stopSignal = WSTOPSIG(terminationStatus);
+                        finishWait(job, 128 + job->stopSignal);
                         if (job->status == BACKGROUND) {
-                                tcsetpgrp(MSH_TERMINAL, MSH_PGID);
                                 changeJobStatus(pid, WAITING_INPUT);
                                 printf("\n[%d]+   suspended [wants input]\t   %s\n",
-                                       numActiveJobs, job->name);
-                        } else {
-                                tcsetpgrp(MSH_TERMINAL, job->pgid);
+                                       job->id, job->name);
+                        } else if (job->status == FOREGROUND) {//reported once per pipeline
                                 changeJobStatus(pid, SUSPENDED);
-                                printf("\n[%d]+   stopped\t   %s\n", numActiveJobs, job->name);
-                        }
-                        return;
-                } else {
-                        if (job->status == BACKGROUND) {
-                                jobsList = delJob(job);
+                                printf("\n[%d]+   stopped\t   %s\n", job->id, job->name);
                         }
+                } else if (WIFCONTINUED(terminationStatus)) {
+                        recordJobEvent(EVENT_CONTINUE, job, pid, 0);
+                        job->stopSignal = 0;
+                        if (job->status == SUSPENDED || job->status == WAITING_INPUT)
+                                changeJobStatus(pid, BACKGROUND);
                 }
-                tcsetpgrp(MSH_TERMINAL, MSH_PGID);
         }
 }
@@ -0,0 +1,617 @@
+/*Lexer and parser of command lines. A whole line is turned in one pass into
+a list of t_pipeline (see declarations.h); every node and every word lives
+in the arena, which is emptied before the next line is read*/
+
+void* arenaAlloc(size_t size)//bump allocation from the current arena block
+{
+        size = (size + 7) & ~(size_t) 7;//keep pointers aligned
+        while (arenaCurrent == NULL || arenaCurrent->used + size > arenaCurrent->size) {
+                if (arenaCurrent != NULL && arenaCurrent->next != NULL
+                    && arenaCurrent->next->size >= size) {
+                        arenaCurrent = arenaCurrent->next;//reuse a block from earlier lines
+                        arenaCurrent->used = 0;
+                        continue;
+                }
+                size_t blockSize = size > ARENA_BLOCK_LENGTH ? size : ARENA_BLOCK_LENGTH;
+                t_arenaBlock *block = malloc(sizeof(t_arenaBlock) + blockSize);
+                block->size = blockSize;
+                block->used = 0;
+                if (arenaCurrent == NULL) {
+                        block->next = NULL;
+                        arenaFirst = block;
+                } else {
+                        block->next = arenaCurrent->next;
+                        arenaCurrent->next = block;
+                }
+                arenaCurrent = block;
+        }
+        void *memory = arenaCurrent->data + arenaCurrent->used;
+        arenaCurrent->used += size;
+        return memory;
+}
+
+char* arenaCopy(const char *text, size_t length)//a NUL terminated copy in the arena
+{
+        char *copy = arenaAlloc(length + 1);
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+        return copy;
+}
+
+void arenaReset()//frees everything allocated for the previous line at once
+{
+        arenaCurrent = arenaFirst;
+        if (arenaCurrent != NULL)
+                arenaCurrent->used = 0;
+}
+
+void appendToWord(char c)//grows the scratch buffer a word is built in
+{
+        if (wordLength + 1 >= wordCapacity) {
+                wordCapacity = wordCapacity ? 2 * wordCapacity : 256;
+                wordBuffer = realloc(wordBuffer, wordCapacity);
+        }
+        wordBuffer[wordLength++] = c;
+}
+
+void appendRunToWord(const char *text, size_t length)
+{
+        if (wordLength + length >= wordCapacity) {
+                while (wordLength + length >= wordCapacity)
+                        wordCapacity = wordCapacity ? 2 * wordCapacity : 256;
+                wordBuffer = realloc(wordBuffer, wordCapacity);
+        }
+        memcpy(wordBuffer + wordLength, text, length);
+        wordLength += length;
+}
+
+int nextToken()
+/*reads the next token at lexerPosition. Operators are returned as their
+TOKEN_ code; for a word, tokenText holds it with quotes and backslashes
+removed and tokenQuoted tells whether any part of it was quoted*/
+{
+        char *c = lexerPosition;
+        while (*c == ' ' || *c == '\t')
+                c++;
+        tokenStart = c;
+        if (*c == '#')//a comment runs to the end of the line
+                while (*c != '\0')
+                        c++;
+        tokenQuoted = FALSE;
+        tokenExpands = FALSE;
+        tokenAssignment = FALSE;
+        redirectDescriptor = -1;
+        if (*c >= '0' && *c <= '9') {//the n of n>file, n<&m and friends
+                char *digits = c;
+                while (*c >= '0' && *c <= '9')
+                        c++;
+                if (*c == '<' || *c == '>')
+                        redirectDescriptor = atoi(digits);
+                else
+                        c = digits;
+        }
+        switch (*c) {
+        case '\0':
+                lexerPosition = c;
+                return TOKEN_END;
+        case '|':
+                lexerPosition = c + (c[1] == '|' ? 2 : 1);
+                return c[1] == '|' ? TOKEN_OR : TOKEN_PIPE;
+        case '&':
+                lexerPosition = c + (c[1] == '&' ? 2 : 1);
+                return c[1] == '&' ? TOKEN_AND : TOKEN_BACKGROUND;
+        case ';':
+                lexerPosition = c + 1;
+                return TOKEN_SEMICOLON;
+        case '<':
+                if (c[1] == '<' && c[2] == '<') {
+                        redirectType = REDIRECT_HERE_STRING;
+                        lexerPosition = c + 3;
+                } else if (c[1] == '<') {//<<- also strips leading tabs from the body
+                        redirectType = REDIRECT_HERE_DOCUMENT;
+                        lexerPosition = c + (c[2] == '-' ? 3 : 2);
+                } else if (c[1] == '&') {
+                        redirectType = REDIRECT_DUPLICATE;
+                        lexerPosition = c + 2;
+                } else {
+                        redirectType = REDIRECT_INPUT;
+                        lexerPosition = c + 1;
+                }
+                if (redirectDescriptor == -1)
+                        redirectDescriptor = STDIN_FILENO;
+                return TOKEN_REDIRECTION;
+        case '>':
+                redirectType = c[1] == '>' ? REDIRECT_APPEND :
+                               c[1] == '&' ? REDIRECT_DUPLICATE : REDIRECT_OUTPUT;
+                lexerPosition = c + (redirectType == REDIRECT_OUTPUT ? 1 : 2);
+                if (redirectDescriptor == -1)
+                        redirectDescriptor = STDOUT_FILENO;
+                return TOKEN_REDIRECTION;
+        }
+
+        wordLength = 0;
+        while (*c != '\0' && strchr(" \t|&;<>", *c) == NULL) {
+                const char *name;
+                size_t nameLength, length;
+                if ((length = strcspn(c, " \t|&;<>\\'\"$`*?[\001\002\003")) > 0) {
+                        appendRunToWord(c, length);//plain characters, copied at once
+                        c += length;
+                } else if (*c == '\\') {//escapes the next character
+                        tokenQuoted = TRUE;
+                        if (c[1] != '\0')
+                                appendLiteral(*++c);
+                        c++;
+                } else if (*c == '\'') {//everything literal up to the next quote
+                        tokenQuoted = TRUE;
+                        for (c++; *c != '\'' && *c != '\0'; c++)
+                                appendLiteral(*c);
+                        if (*c == '\0')
+                                return TOKEN_ERROR;
+                        c++;
+                } else if (*c == '"') {//only \ " $ ` and \ can be escaped inside
+                        tokenQuoted = TRUE;
+                        for (c++; *c != '"' && *c != '\0'; c++) {
+                                if (*c == '\\' && c[1] != '\0' && strchr("\"\\$`", c[1])) {
+                                        appendLiteral(*++c);
+                                } else if (*c == '`' || (*c == '$' && c[1] == '(')) {
+                                        if ((length = substitutionLength(c)) == 0)
+                                                return TOKEN_ERROR;
+                                        appendSubstitution(c, length, VARIABLE_QUOTED);
+                                        c += length - 1;
+                                } else if (*c == '$'
+                                           && (length = variableReference(c, &name,
+                                                                          &nameLength))) {
+                                        appendVariable(name, nameLength, VARIABLE_QUOTED);
+                                        c += length - 1;
+                                } else {
+                                        appendLiteral(*c);
+                                }
+                        }
+                        if (*c == '\0')
+                                return TOKEN_ERROR;
+                        c++;
+                } else if (*c == '`' || (*c == '$' && c[1] == '(')) {
+                        if ((length = substitutionLength(c)) == 0)
+                                return TOKEN_ERROR;
+                        appendSubstitution(c, length, VARIABLE_SPLIT);
+                        c += length;
+                } else if (*c == '$' && (length = variableReference(c, &name, &nameLength))) {
+                        appendVariable(name, nameLength, VARIABLE_SPLIT);
+                        c += length;
+                } else if (*c == '*' || *c == '?' || *c == '[') {
+                        appendToWord(GLOB_MARK);//matched against file names later
+                        appendToWord(*c++);
+                        tokenExpands = TRUE;
+                } else {
+                        appendLiteral(*c++);
+                }
+        }
+        /*NAME=value, with NAME as typed: names cannot hold quotes or marks*/
+        char *equals = tokenStart;
+        while (*equals == '_' || (*equals >= 'a' && *equals <= 'z')
+               || (*equals >= 'A' && *equals <= 'Z') || (*equals >= '0' && *equals <= '9'))
+                equals++;
+        tokenAssignment = *equals == '=' && isVariableName(tokenStart, equals - tokenStart);
+        lexerPosition = c;
+        tokenText = arenaCopy(wordBuffer, wordLength);
+        return TOKEN_WORD;
+}
+
+void addArgument(int *argc, char *word)//to the arguments scratch array
+{
+        if (*argc + 1 >= argumentsCapacity) {
+                argumentsCapacity = argumentsCapacity ? 2 * argumentsCapacity : 64;
+                arguments = realloc(arguments, argumentsCapacity * sizeof(char*));
+        }
+        arguments[(*argc)++] = word;
+}
+
+void saveToken(t_token* token)//the word just read and where the lexer is
+{
+        token->lexerPosition = lexerPosition;
+        token->tokenStart = tokenStart;
+        token->tokenText = tokenText;
+        token->tokenQuoted = tokenQuoted;
+        token->tokenExpands = tokenExpands;
+        token->tokenAssignment = tokenAssignment;
+        token->redirectDescriptor = redirectDescriptor;
+}
+
+void restoreToken(t_token* token)//goes back to a word read before
+{
+        lexerPosition = token->lexerPosition;
+        tokenStart = token->tokenStart;
+        tokenText = token->tokenText;
+        tokenQuoted = token->tokenQuoted;
+        tokenExpands = token->tokenExpands;
+        tokenAssignment = token->tokenAssignment;
+        redirectDescriptor = token->redirectDescriptor;
+}
+
+void appendLiteral(char c)//a character of a word, as it is
+{
+        if ((unsigned char) c <= GLOB_MARK) {//the marks are 1, 2 and 3
+                appendToWord(c);//doubled, so it is not taken for a reference
+                tokenExpands = TRUE;
+        }
+        appendToWord(c);
+}
+
+void appendVariable(const char *name, size_t nameLength, char mark)
+/*a reference, expanded when the command runs, see expandWord()*/
+{
+        appendToWord(mark);
+        for (size_t i = 0; i < nameLength; i++)
+                appendToWord(name[i]);
+        appendToWord(mark);
+        tokenExpands = TRUE;
+}
+
+size_t variableReference(const char *c, const char **name, size_t *nameLength)
+/*the length of the $NAME, ${NAME}, $? or $$ at c, 0 if there is none; a $
+of anything else is just a $*/
+{
+        int braced = (c[1] == '{');
+        const char *start = c + 1 + braced;
+        const char *end = start;
+
+        if (*start == '?' || *start == '$') {
+                end++;
+        } else {
+                while (*end == '_' || (*end >= 'a' && *end <= 'z') || (*end >= 'A' && *end <= 'Z')
+                       || (*end >= '0' && *end <= '9'))
+                        end++;
+                if (!isVariableName(start, end - start))
+                        return 0;//positional parameters like $1 neither
+        }
+        *name = start;
+        *nameLength = end - start;
+        if (braced && *end++ != '}')
+                return 0;
+        return end - c;
+}
+
+size_t substitutionLength(const char *c)
+/*the length of the $(...) or `...` at c, 0 when it is not closed. Quotes,
+escapes and nested parentheses inside are skipped over, so a ) in them does
+not end it*/
+{
+        const char *start = c;
+        int depth = 0;
+
+        if (*c == '`') {
+                for (c++; *c != '`'; c++) {
+                        if (*c == '\0')
+                                return 0;
+                        if (*c == '\\' && c[1] != '\0')
+                                c++;
+                }
+                return c - start + 1;
+        }
+        for (c++; ; c++) {
+                switch (*c) {
+                case '\0':
+                        return 0;
+                case '(':
+                        depth++;
+                        break;
+                case ')':
+                        if (--depth == 0)
+                                return c - start + 1;
+                        break;
+                case '\\':
+                        if (c[1] != '\0')
+                                c++;
+                        break;
+                case '\'':
+                        if ((c = strchr(c + 1, '\'')) == NULL)
+                                return 0;
+                        break;
+                case '"':
+                case '`':
+                        for (char quote = *c++; *c != quote; c++) {
+                                if (*c == '\0')
+                                        return 0;
+                                if (*c == '\\' && c[1] != '\0')
+                                        c++;
+                        }
+                        break;
+                }
+        }
+}
+
+void appendSubstitution(const char *c, size_t length, char mark)
+/*a command substitution, run when its command is, see commandOutput(). It
+is kept like a reference, one whose name is ( and the command. Inside `...`
+a \ before $, ` or \ goes*/
+{
+        appendToWord(mark);
+        appendToWord('(');
+        if (*c == '`') {
+                for (size_t i = 1; i < length - 1; i++) {
+                        if (c[i] == '\\' && strchr("$`\\", c[i + 1]) != NULL)
+                                i++;
+                        appendToWord(c[i]);
+                }
+        } else {
+                appendRunToWord(c + 2, length - 3);
+        }
+        appendToWord(mark);
+        tokenExpands = TRUE;
+}
+
+int isVariableName(const char *name, size_t length)//letters, digits and _, not starting with a digit
+{
+        if (length == 0 || (*name >= '0' && *name <= '9'))
+                return FALSE;
+        for (size_t i = 0; i < length; i++)
+                if (!(name[i] == '_' || (name[i] >= 'a' && name[i] <= 'z')
+                      || (name[i] >= 'A' && name[i] <= 'Z') || (name[i] >= '0' && name[i] <= '9')))
+                        return FALSE;
+        return TRUE;
+}
+
+t_pipeline* parseCommandLine(char *line)
+/*list     := andOr ((';' | '&') andOr)* [';' | '&']
+andOr    := pipeline (('&&' | '||') pipeline)*
+pipeline := ['time'] ['limit' (--option value)+] ['bg' [in | out file]]
+            command ('|' command)*
+command  := (word | redirection)+, leading NAME=value words are assignments
+Returns NULL for an empty line or after reporting a syntax error*/
+{
+        t_pipeline *first = NULL, *last = NULL;
+        int connector = CONNECT_SEQUENCE;
+
+        lexerPosition = line;
+        numHereDocuments = 0;
+        parsedToken = nextToken();
+        while (parsedToken != TOKEN_END) {
+                t_pipeline *pipeline = parsePipeline();
+                if (pipeline == NULL)
+                        return NULL;
+                pipeline->connector = connector;
+                if (first == NULL)
+                        first = pipeline;
+                else
+                        last->next = pipeline;
+                last = pipeline;
+
+                if (parsedToken == TOKEN_END)
+                        break;
+                switch (parsedToken) {
+                case TOKEN_BACKGROUND:
+                        pipeline->executionMode = BACKGROUND;
+                        /*fall through*/
+                case TOKEN_SEMICOLON:
+                        connector = CONNECT_SEQUENCE;
+                        break;
+                case TOKEN_AND:
+                        connector = CONNECT_AND;
+                        break;
+                case TOKEN_OR:
+                        connector = CONNECT_OR;
+                        break;
+                default:
+                        return syntaxError();
+                }
+                parsedToken = nextToken();
+                if (parsedToken == TOKEN_END && connector != CONNECT_SEQUENCE)
+                        return syntaxError();//a && or || needs a right-hand side
+        }
+        return first;
+}
+
+t_pipeline* parsePipeline()
+{
+        t_pipeline *pipeline = arenaAlloc(sizeof(t_pipeline));
+        t_command *last = NULL;
+        char *start = tokenStart;
+        memset(pipeline, 0, sizeof(t_pipeline));
+        pipeline->executionMode = FOREGROUND;
+
+        if (parsedToken == TOKEN_WORD && !tokenQuoted && strcmp(tokenText, "time") == 0) {
+                pipeline->timed = TRUE;
+                parsedToken = nextToken();
+        }
+        /*limit --option value... command: the job runs with the resource
+        limits given, see resources.h, which checks the options when it starts*/
+        if (parsedToken == TOKEN_WORD && !tokenQuoted && strcmp(tokenText, "limit") == 0) {
+                t_token limit;
+                saveToken(&limit);
+                int token = nextToken();
+                int argc = 0;
+                while (token == TOKEN_WORD && !tokenQuoted && strncmp(tokenText, "--", 2) == 0) {
+                        addArgument(&argc, tokenText);
+                        if ((token = nextToken()) != TOKEN_WORD) {
+                                parsedToken = token;
+                                return syntaxError();//an option without its value
+                        }
+                        addArgument(&argc, tokenText);
+                        token = nextToken();
+                }
+                if (argc > 0) {
+                        pipeline->limits = arenaAlloc((argc + 1) * sizeof(char*));
+                        memcpy(pipeline->limits, arguments, argc * sizeof(char*));
+                        pipeline->limits[argc] = NULL;
+                        parsedToken = token;
+                } else {
+                        restoreToken(&limit);//limit without options is a command
+                }
+        }
+        /*bg [in file | out file] command: the job runs in the background
+        with its stdin or stdout redirected to file*/
+        if (parsedToken == TOKEN_WORD && !tokenQuoted && strcmp(tokenText, "bg") == 0) {
+                t_token bg;
+                saveToken(&bg);
+                int token = nextToken();
+                if (token == TOKEN_WORD) {
+                        pipeline->executionMode = BACKGROUND;
+                        parsedToken = token;
+                        if (!tokenQuoted && (strcmp(tokenText, "in") == 0
+                                             || strcmp(tokenText, "out") == 0)) {
+                                int input = (tokenText[0] == 'i');
+                                if (nextToken() != TOKEN_WORD)
+                                        return syntaxError();
+                                pipeline->backgroundFile = tokenText;
+                                pipeline->backgroundDescriptor = input ? STDIN : STDOUT;
+                                parsedToken = nextToken();
+                        }
+                } else {
+                        restoreToken(&bg);//a lone bg is the builtin
+                }
+        }
+        while (TRUE) {
+                t_command *command = parseSimpleCommand();
+                if (command == NULL)
+                        return NULL;
+                if (last == NULL)
+                        pipeline->commands = command;
+                else
+                        last->next = command;
+                last = command;
+                pipeline->numCommands++;
+                if (parsedToken != TOKEN_PIPE)
+                        break;
+                parsedToken = nextToken();
+        }
+
+        char *end = tokenStart;//of the token after the pipeline
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+                end--;
+        pipeline->text = arenaCopy(start, end - start);
+
+        if (pipeline->backgroundFile != NULL) {//bg in/out apply to the ends of the pipeline
+                t_command *command = pipeline->backgroundDescriptor == STDIN ?
+                                     pipeline->commands : last;
+                t_redirection *redirection = arenaAlloc(sizeof(t_redirection));
+                redirection->type = pipeline->backgroundDescriptor == STDIN ?
+                                    REDIRECT_INPUT : REDIRECT_OUTPUT;
+                redirection->descriptor = pipeline->backgroundDescriptor == STDIN ?
+                                          STDIN_FILENO : STDOUT_FILENO;
+                redirection->target = pipeline->backgroundFile;
+                redirection->source = -1;
+                redirection->stripTabs = FALSE;
+                redirection->next = command->redirections;
+                command->redirections = redirection;
+        }
+        return pipeline;
+}
+
+t_command* parseSimpleCommand()
+{
+        t_command *command = arenaAlloc(sizeof(t_command));
+        t_redirection **lastRedirection = &command->redirections;
+        int argc = 0, numAssignments = 0;
+
+        command->redirections = NULL;
+        command->next = NULL;
+        command->expands = FALSE;
+        while (TRUE) {
+                if (parsedToken == TOKEN_WORD) {
+                        addArgument(&argc, tokenText);
+                        if (tokenAssignment && argc == numAssignments + 1)
+                                numAssignments++;//only before the command name
+                        command->expands |= tokenExpands;
+                } else if (parsedToken == TOKEN_REDIRECTION) {
+                        t_redirection *redirection = arenaAlloc(sizeof(t_redirection));
+                        redirection->type = redirectType;
+                        redirection->descriptor = redirectDescriptor;
+                        redirection->source = -1;
+                        redirection->stripTabs = (redirectType == REDIRECT_HERE_DOCUMENT
+                                                  && lexerPosition[-1] == '-');
+                        redirection->next = NULL;
+                        if ((parsedToken = nextToken()) != TOKEN_WORD)
+                                return syntaxError();
+                        redirection->target = tokenText;
+                        command->expands |= tokenExpands;
+                        if (redirection->type == REDIRECT_DUPLICATE
+                            && strcmp(tokenText, "-") != 0) {//n>&m, or n>&- to close n
+                                char *end;
+                                long source = strtol(tokenText, &end, 10);
+                                if (*tokenText == '\0' || *end != '\0' || source > INT_MAX)
+                                        return syntaxError();
+                                redirection->source = (int) source;
+                        }
+                        if (redirection->type == REDIRECT_HERE_DOCUMENT) {//body read later
+                                if (numHereDocuments == hereDocumentsCapacity) {
+                                        hereDocumentsCapacity = hereDocumentsCapacity ?
+                                                                2 * hereDocumentsCapacity : 4;
+                                        hereDocuments = realloc(hereDocuments,
+                                                                hereDocumentsCapacity
+                                                                * sizeof(t_redirection*));
+                                }
+                                hereDocuments[numHereDocuments++] = redirection;
+                        }
+                        *lastRedirection = redirection;
+                        lastRedirection = &redirection->next;
+                } else {
+                        break;
+                }
+                parsedToken = nextToken();
+        }
+        if (parsedToken == TOKEN_ERROR) {
+                fprintf(stderr, "MSH: syntax error: unterminated quote\n");
+                lastExitStatus = 2;
+                return NULL;
+        }
+        if (argc == 0)
+                return syntaxError();
+        /*A command of assignments only has an empty argv, see runBuiltIn()*/
+        arguments[argc] = NULL;
+        command->numAssignments = numAssignments;
+        command->assignments = NULL;
+        if (numAssignments > 0) {
+                command->assignments = arenaAlloc(numAssignments * sizeof(char*));
+                memcpy(command->assignments, arguments, numAssignments * sizeof(char*));
+        }
+        command->argc = argc - numAssignments;
+        command->argv = arenaAlloc((command->argc + 1) * sizeof(char*));
+        memcpy(command->argv, arguments + numAssignments, (command->argc + 1) * sizeof(char*));
+        return command;
+}
+
+void* syntaxError()//reports the token the parser stopped at
+{
+        if (parsedToken == TOKEN_ERROR) {
+                fprintf(stderr, "MSH: syntax error: unterminated quote\n");
+        } else if (parsedToken == TOKEN_END) {
+                fprintf(stderr, "MSH: syntax error: unexpected end of line\n");
+        } else {
+                fprintf(stderr, "MSH: syntax error near `%.*s'\n",
+                        (int) (lexerPosition - tokenStart), tokenStart);
+        }
+        lastExitStatus = 2;
+        return NULL;
+}
+
+void readHereDocuments()
+/*the bodies of the line's here-documents follow it in the input, one after
+the other in the order of their <<. Each is kept in the arena with the rest of
+the command tree, and handed to the command through a pipe or a memfd*/
+{
+        for (int i = 0; i < numHereDocuments; i++) {
+                t_redirection *redirection = hereDocuments[i];
+                wordLength = 0;
+                while (TRUE) {
+                        if (MSH_IS_INTERACTIVE) {
+                                printf("> ");
+                                fflush(stdout);
+                        }
+                        if (readLine() == EOF) {
+                                fprintf(stderr, "MSH: here-document ended by end of file "
+                                        "(wanted `%s')\n", redirection->target);
+                                break;
+                        }
+                        char *line = buffer;
+                        if (redirection->stripTabs)
+                                while (*line == '\t')
+                                        line++;
+                        if (strcmp(line, redirection->target) == 0)
+                                break;
+                        while (*line != '\0')
+                                appendToWord(*line++);
+                        appendToWord('\n');
+                }
+                redirection->target = arenaCopy(wordBuffer, wordLength);
+        }
+}
@@ -0,0 +1,221 @@
+/*The prompt is the MSH_PROMPT variable, with these escapes:
+%d the current directory    %~ the same, with $HOME shown as ~
+%? the last exit status     %j the number of jobs
+%b the git branch           %% a %
+Nothing in it asks the kernel for the current directory: changeDirectory()
+keeps currentDirectory up to date. The git branch means reading files on
+what may be a slow network mount, so a worker thread looks it up; the prompt
+waits for it a few milliseconds at most, and shows the branch last found for
+the directory meanwhile*/
+
+void renderPrompt()//the prompt, in promptText
+{
+        char *format = lookupVariable("MSH_PROMPT");
+        char number[16];
+        char *home = lookupVariable("HOME");
+
+        if (format == NULL)
+                format = "%d \\m/ ";//Prompt symbol of our shell is '\m/'
+        promptLength = 0;
+        for (char *c = format; *c != '\0'; c++) {
+                if (*c != '%' || c[1] == '\0') {
+                        appendBytes(&promptText, &promptLength, &promptCapacity, c, 1);
+                        continue;
+                }
+                char *segment = NULL;
+                switch (*++c) {
+                case 'd':
+                        segment = currentDirectory;
+                        break;
+                case '~': {
+                        size_t homeLength = home ? strlen(home) : 0;
+                        segment = currentDirectory;
+                        if (homeLength > 1 && strncmp(currentDirectory, home, homeLength) == 0
+                            && (currentDirectory[homeLength] == '/'
+                                || currentDirectory[homeLength] == '\0')) {
+                                appendBytes(&promptText, &promptLength, &promptCapacity, "~", 1);
+                                segment = currentDirectory + homeLength;
+                        }
+                        break;
+                }
+                case '?':
+                        sprintf(number, "%d", lastExitStatus);
+                        segment = number;
+                        break;
+                case 'j':
+                        sprintf(number, "%d", numActiveJobs);
+                        segment = number;
+                        break;
+                case 'b':
+                        segment = gitBranch();
+                        break;
+                default://%% and unknown escapes stand for themselves
+                        number[0] = *c;
+                        number[1] = '\0';
+                        segment = number;
+                        break;
+                }
+                appendBytes(&promptText, &promptLength, &promptCapacity, segment, strlen(segment));
+        }
+        appendBytes(&promptText, &promptLength, &promptCapacity, "", 1);
+}
+
+char* gitBranch()
+/*the branch of the repository the current directory is in, "" if none. It
+is asked of the worker thread, which gets PROMPT_TIMEOUT_MS to answer*/
+{
+        struct timespec deadline;
+
+        pthread_mutex_lock(&promptLock);
+        if (!promptWorkerStarted) {
+                promptWorkerStarted = pthread_create(&promptWorker, NULL, branchWorker, NULL) == 0;
+                if (!promptWorkerStarted) {
+                        pthread_mutex_unlock(&promptLock);
+                        return "";
+                }
+        }
+        if (branchRequest == NULL) {//a slow lookup may still be running; it is not asked twice
+                branchRequest = strdup(currentDirectory);
+                branchReady = FALSE;
+                pthread_cond_signal(&branchRequested);
+        }
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PROMPT_TIMEOUT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+        }
+        while (!branchReady
+               && pthread_cond_timedwait(&branchAnswered, &promptLock, &deadline) == 0)
+                ;
+        /*late or not, show only what was found for this very directory*/
+        if (branchDirectory != NULL && strcmp(branchDirectory, currentDirectory) == 0)
+                snprintf(shownBranch, sizeof(shownBranch), "%s", branchName);
+        else
+                shownBranch[0] = '\0';
+        pthread_mutex_unlock(&promptLock);
+        return shownBranch;
+}
+
+void* branchWorker(void *unused)//the prompt's worker thread
+{
+        char branch[sizeof(branchName)];
+        sigset_t signals;
+
+        (void) unused;
+        sigfillset(&signals);//signals are for the main thread
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        pthread_mutex_lock(&promptLock);
+        while (TRUE) {
+                while (branchRequest == NULL || branchReady)
+                        pthread_cond_wait(&branchRequested, &promptLock);
+                char *directory = branchRequest;
+                pthread_mutex_unlock(&promptLock);
+
+                findGitBranch(directory, branch, sizeof(branch));
+
+                pthread_mutex_lock(&promptLock);
+                free(branchDirectory);
+                branchDirectory = directory;
+                strcpy(branchName, branch);
+                branchRequest = NULL;
+                branchReady = TRUE;
+                pthread_cond_signal(&branchAnswered);
+        }
+        return NULL;
+}
+
+void findGitBranch(const char *directory, char *branch, size_t size)
+/*reads .git/HEAD in directory or the closest parent that has one: the branch
+name, or the start of the commit id when HEAD is detached*/
+{
+        char *path = malloc(strlen(directory) + 64);
+        char head[256];
+        branch[0] = '\0';
+        strcpy(path, directory);
+        while (TRUE) {
+                size_t length = strlen(path);
+                strcpy(path + length, "/.git/HEAD");
+                int file = open(path, O_RDONLY | O_CLOEXEC);
+                if (file == -1) {//a worktree or submodule has a .git file pointing elsewhere
+                        strcpy(path + length, "/.git");
+                        file = open(path, O_RDONLY | O_CLOEXEC);
+                        ssize_t count = file == -1 ? -1 : read(file, head, sizeof(head) - 1);
+                        if (file != -1) {
+                                close(file);
+                                file = -1;//or HEAD would be read from whatever reuses the number
+                        }
+                        if (count > 8 && strncmp(head, "gitdir: ", 8) == 0) {
+                                head[count] = '\0';
+                                head[strcspn(head, "\n")] = '\0';
+                                char *gitDirectory = head + 8;
+                                path = realloc(path, length + strlen(gitDirectory) + 16);
+                                if (gitDirectory[0] == '/')
+                                        sprintf(path, "%s/HEAD", gitDirectory);
+                                else
+                                        sprintf(path + length, "/%s/HEAD", gitDirectory);
+                                file = open(path, O_RDONLY | O_CLOEXEC);
+                                if (file == -1)
+                                        break;//the repository is there, but unreadable
+                        }
+                }
+                if (file != -1) {
+                        ssize_t count = read(file, head, sizeof(head) - 1);
+                        close(file);
+                        file = -1;
+                        if (count > 0) {
+                                head[count] = '\0';
+                                head[strcspn(head, "\n")] = '\0';
+                                if (strncmp(head, "ref: refs/heads/", 16) == 0)
+                                        snprintf(branch, size, "%s", head + 16);
+                                else
+                                        snprintf(branch, size, "%.7s", head);
+                        }
+                        break;
+                }
+                path[length] = '\0';
+                char *slash = strrchr(path, '/');
+                if (slash == NULL || length <= 1)
+                        break;//the root was the last place to look
+                *(slash == path ? slash + 1 : slash) = '\0';
+        }
+        free(path);
+}
+
+char* logicalPath(const char *target)
+/*the directory cd target leads to, worked out from currentDirectory like
+other shells do, so .. goes back the way a symbolic link was followed*/
+{
+        size_t length = strlen(target) + (target[0] == '/' ? 0 : strlen(currentDirectory)) + 2;
+        char *path = malloc(length);
+        size_t end = 0;
+
+        if (target[0] != '/') {
+                strcpy(path, currentDirectory);
+                end = strlen(path);
+        }
+        path[end] = '\0';
+        for (const char *c = target; *c != '\0'; ) {
+                while (*c == '/')
+                        c++;
+                size_t nameLength = strcspn(c, "/");
+                if (nameLength == 0)
+                        break;
+                if (nameLength == 2 && c[0] == '.' && c[1] == '.') {
+                        while (end > 0 && path[end - 1] != '/')
+                                end--;
+                        if (end > 0)
+                                end--;//the slash
+                } else if (!(nameLength == 1 && c[0] == '.')) {
+                        if (end == 0 || path[end - 1] != '/')
+                                path[end++] = '/';
+                        memcpy(path + end, c, nameLength);
+                        end += nameLength;
+                }
+                path[end] = '\0';
+                c += nameLength;
+        }
+        if (end == 0)
+                strcpy(path, "/");
+        return path;
+}
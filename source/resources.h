@@ -0,0 +1,422 @@
+/*limit --mem 2G --cpu 1.5 --pids 100 command runs the job in a cgroup v2 of
+its own, made in the shell's cgroup (or in MSH_CGROUP, a delegated one) and
+removed with the job, with memory.max, cpu.max and pids.max set. Where the
+cgroup or one of those files cannot be written, --mem and --pids fall back
+to setrlimit() on each process: RLIMIT_AS and RLIMIT_NPROC, which are not
+quite the same, and say so. The shell's own cgroup can only hand controllers
+to the jobs' ones if nothing else runs in it, so outside a delegated
+MSH_CGROUP the fallbacks are what one mostly gets. The ulimit-like options are setrlimit() anyway:
+--nofile --nproc --cpu-time (seconds) --fsize --core --stack --as
+Sizes take a K, M, G or T suffix, and unlimited is a value too.
+--cpus 0-3,8 and --numa-node 1 place the job: its processes are bound to
+those CPUs, or to the node's, and take their memory from that node. Without
+them, background jobs go on the CPUs in MSH_BG_CPUS, and foreground jobs on
+those in MSH_FG_CPUS, or on all but MSH_BG_CPUS when it is not set*/
+
+int parseLimits(char **options, t_limits* limits)//-1, reported, if one is wrong
+{
+        static const struct {
+                const char *option;
+                int resource;
+                int isSize;
+        } resourceOptions[] = {
+                { "--nofile", RLIMIT_NOFILE, FALSE }, { "--nproc", RLIMIT_NPROC, FALSE },
+                { "--cpu-time", RLIMIT_CPU, FALSE }, { "--fsize", RLIMIT_FSIZE, TRUE },
+                { "--core", RLIMIT_CORE, TRUE }, { "--stack", RLIMIT_STACK, TRUE },
+                { "--as", RLIMIT_AS, TRUE }, { NULL, 0, FALSE }
+        };
+
+        clearLimits(limits);
+        for (int i = 0; options[i] != NULL; i += 2) {
+                char *option = options[i], *value = options[i + 1], *end;
+                int known = TRUE;
+                long long number = parseSize(value);
+                if (strcmp(option, "--mem") == 0) {
+                        limits->memory = number;
+                } else if (strcmp(option, "--cpu") == 0) {
+                        limits->cpus = strtod(value, &end);
+                        number = (*end != '\0' || !(limits->cpus > 0)) ? -2 : 0;
+                } else if (strcmp(option, "--cpus") == 0) {
+                        limits->hasCpus = TRUE;
+                        number = parseCpuList(value, &limits->affinity) == -1 ? -2 : 0;
+                } else if (strcmp(option, "--numa-node") == 0) {
+                        limits->numaNode = (int) strtol(value, &end, 10);
+                        number = (*end != '\0' || *value < '0' || *value > '9'
+                                  || limits->numaNode > 1023) ? -2 : 0;
+                } else if (strcmp(option, "--pids") == 0) {
+                        if (strpbrk(value, "KkMmGgTt") != NULL && number >= 0)
+                                number = -2;//a count has no unit
+                        limits->pids = number;
+                } else {
+                        int j = 0;
+                        while (resourceOptions[j].option != NULL
+                               && strcmp(resourceOptions[j].option, option) != 0)
+                                j++;
+                        known = resourceOptions[j].option != NULL;
+                        if (known && !resourceOptions[j].isSize && number >= 0
+                            && strpbrk(value, "KkMmGgTt") != NULL)
+                                number = -2;//a count has no unit
+                        if (known && number != -2)
+                                addResourceLimit(limits, resourceOptions[j].resource,
+                                                 number == -1 ? RLIM_INFINITY : (rlim_t) number);
+                }
+                if (!known) {
+                        fprintf(stderr, "limit: %s: no such option\n", option);
+                        return -1;
+                }
+                if (number == -2) {
+                        fprintf(stderr, "limit: %s: bad value `%s'\n", option, value);
+                        return -1;
+                }
+        }
+        if (limits->numaNode != -1 && !limits->hasCpus) {//the node's own CPUs
+                if (readNodeCpus(limits->numaNode, &limits->affinity) == -1) {
+                        fprintf(stderr, "limit: --numa-node: no node %d\n", limits->numaNode);
+                        return -1;
+                }
+                limits->hasCpus = TRUE;
+        }
+        return 0;
+}
+
+void clearLimits(t_limits* limits)//no limits and no placement
+{
+        memset(limits, 0, sizeof(t_limits));
+        limits->memory = -1;
+        limits->pids = -1;
+        limits->procsDescriptor = -1;
+        limits->numaNode = -1;
+}
+
+int placeJob(t_limits* limits, int executionMode)
+/*the shell's placement for a job limit did not place, from MSH_BG_CPUS and
+MSH_FG_CPUS. Returns whether the job has a placement now*/
+{
+        char *background = lookupVariable("MSH_BG_CPUS");
+        char *foreground = lookupVariable("MSH_FG_CPUS");
+        cpu_set_t backgroundCpus, shellCpus;
+
+        if (limits->hasCpus || limits->numaNode != -1)
+                return TRUE;
+        if (background == NULL || *background == '\0') {
+                if (executionMode == FOREGROUND && foreground != NULL && *foreground != '\0')
+                        limits->hasCpus = parseCpuList(foreground, &limits->affinity) == 0;
+        } else if (executionMode == BACKGROUND) {
+                limits->hasCpus = parseCpuList(background, &limits->affinity) == 0;
+        } else if (foreground != NULL && *foreground != '\0') {
+                limits->hasCpus = parseCpuList(foreground, &limits->affinity) == 0;
+        } else if (parseCpuList(background, &backgroundCpus) == 0
+                   && sched_getaffinity(0, sizeof(cpu_set_t), &shellCpus) == 0) {
+                CPU_XOR(&limits->affinity, &shellCpus, &backgroundCpus);//the shell's others
+                CPU_AND(&limits->affinity, &limits->affinity, &shellCpus);
+                limits->hasCpus = CPU_COUNT(&limits->affinity) > 0;
+        }
+        return limits->hasCpus;
+}
+
+int parseCpuList(const char *text, cpu_set_t *cpus)//0-3,8 like the kernel writes them; -1 if wrong
+{
+        char *end;
+        CPU_ZERO(cpus);
+        while (TRUE) {
+                if (*text < '0' || *text > '9')
+                        return -1;
+                long first = strtol(text, &end, 10), last = first;
+                if (*end == '-') {
+                        text = end + 1;
+                        if (*text < '0' || *text > '9')
+                                return -1;
+                        last = strtol(text, &end, 10);
+                }
+                if (last < first || last >= CPU_SETSIZE)
+                        return -1;
+                for (long cpu = first; cpu <= last; cpu++)
+                        CPU_SET(cpu, cpus);
+                if (*end == '\0' || *end == '\n')
+                        return 0;
+                if (*end != ',')
+                        return -1;
+                text = end + 1;
+        }
+}
+
+int readNodeCpus(int node, cpu_set_t *cpus)//the CPUs of a NUMA node, -1 if there is no such node
+{
+        char path[64], list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        int file = open(path, O_RDONLY | O_CLOEXEC);
+        if (file == -1)
+                return -1;
+        ssize_t count = read(file, list, sizeof(list) - 1);
+        close(file);
+        if (count <= 0)
+                return -1;
+        list[count] = '\0';
+        return parseCpuList(list, cpus);
+}
+
+char* describePlacement(t_limits* limits)
+/*"cpus 0-3, numa node 1", malloc()ed, for jobs; NULL without a placement*/
+{
+        char *text = NULL, number[32];
+        size_t length = 0, capacity = 0;
+
+        if (!limits->hasCpus && limits->numaNode == -1)
+                return NULL;
+        appendBytes(&text, &length, &capacity, "cpus ", 5);
+        for (int cpu = 0, first = 1; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, &limits->affinity))
+                        continue;
+                int last = cpu;
+                while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &limits->affinity))
+                        last++;
+                if (last == cpu)
+                        snprintf(number, sizeof(number), "%s%d", first ? "" : ",", cpu);
+                else
+                        snprintf(number, sizeof(number), "%s%d-%d", first ? "" : ",", cpu, last);
+                appendBytes(&text, &length, &capacity, number, strlen(number));
+                first = 0;
+                cpu = last;
+        }
+        if (limits->numaNode != -1) {
+                snprintf(number, sizeof(number), ", numa node %d", limits->numaNode);
+                appendBytes(&text, &length, &capacity, number, strlen(number));
+        }
+        appendBytes(&text, &length, &capacity, "", 1);
+        return text;
+}
+
+long long parseSize(const char *text)//2G and the like; -1 for unlimited, -2 if it is wrong
+{
+        char *end;
+        if (strcmp(text, "unlimited") == 0 || strcmp(text, "max") == 0)
+                return -1;
+        if (*text < '0' || *text > '9')
+                return -2;
+        unsigned long long number = strtoull(text, &end, 10);
+        int shift = 0;
+        switch (*end) {
+        case 'K': case 'k':
+                shift = 10;
+                break;
+        case 'M': case 'm':
+                shift = 20;
+                break;
+        case 'G': case 'g':
+                shift = 30;
+                break;
+        case 'T': case 't':
+                shift = 40;
+                break;
+        case '\0':
+                break;
+        default:
+                return -2;
+        }
+        if (shift != 0 && *++end != '\0')
+                return -2;
+        if (number > (unsigned long long) LLONG_MAX >> shift)
+                return -2;
+        return (long long) (number << shift);
+}
+
+void addResourceLimit(t_limits* limits, int resource, rlim_t value)//the last one given wins
+{
+        int i = 0;
+        while (i < limits->numResources && limits->resources[i] != resource)
+                i++;
+        if (i == LIMIT_RESOURCES)
+                return;
+        limits->resources[i] = resource;
+        limits->values[i] = value;
+        if (i == limits->numResources)
+                limits->numResources++;
+}
+
+int makeJobCgroup(t_limits* limits)
+/*the job's cgroup, with the limits it can take written to it. Those it
+cannot take are left to setrlimit(). Returns -1 when there is none*/
+{
+        char *parent = NULL, value[64];
+        int memorySet = FALSE, pidsSet = FALSE, cpuSet = FALSE;
+
+        if (limits->memory != -1 || limits->pids != -1 || limits->cpus > 0)
+                parent = findCgroupParent();
+        if (parent != NULL) {
+                limits->cgroup = malloc(strlen(parent) + 64);
+                sprintf(limits->cgroup, "%s/msh-%d-%d", parent, (int) MSH_PID, ++numCgroups);
+                if (mkdir(limits->cgroup, 0755) == 0) {
+                        if (limits->memory != -1) {
+                                snprintf(value, sizeof(value), "%lld", limits->memory);
+                                memorySet = writeCgroupFile(limits->cgroup, "memory.max", value) == 0;
+                        }
+                        if (limits->pids != -1) {
+                                snprintf(value, sizeof(value), "%ld", limits->pids);
+                                pidsSet = writeCgroupFile(limits->cgroup, "pids.max", value) == 0;
+                        }
+                        if (limits->cpus > 0) {
+                                snprintf(value, sizeof(value), "%ld %d",
+                                         (long) (limits->cpus * CPU_PERIOD), CPU_PERIOD);
+                                cpuSet = writeCgroupFile(limits->cgroup, "cpu.max", value) == 0;
+                        }
+                        char path[strlen(limits->cgroup) + 16];
+                        sprintf(path, "%s/cgroup.procs", limits->cgroup);
+                        limits->procsDescriptor = open(path, O_WRONLY | O_CLOEXEC);
+                }
+                if (limits->procsDescriptor == -1) {//no cgroup after all
+                        rmdir(limits->cgroup);
+                        free(limits->cgroup);
+                        limits->cgroup = NULL;
+                        memorySet = pidsSet = cpuSet = FALSE;
+                }
+        }
+        if (limits->memory != -1 && !memorySet) {
+                warnFallback("--mem", "memory", "using RLIMIT_AS, which limits "
+                             "address space, not memory used");
+                addResourceLimit(limits, RLIMIT_AS, (rlim_t) limits->memory);
+        }
+        if (limits->pids != -1 && !pidsSet) {
+                warnFallback("--pids", "pids", "using RLIMIT_NPROC, which counts "
+                             "every process of the user, not the job's");
+                addResourceLimit(limits, RLIMIT_NPROC, (rlim_t) limits->pids);
+        }
+        if (limits->cpus > 0 && !cpuSet)
+                warnFallback("--cpu", "cpu", "running without");
+        return limits->cgroup ? 0 : -1;
+}
+
+void warnFallback(const char *option, const char *controller, const char *instead)
+{
+        char *delegated = lookupVariable("MSH_CGROUP");
+        fprintf(stderr, "limit: %s: no cgroup with the %s controller%s, %s\n", option,
+                controller, delegated == NULL || *delegated == '\0' ?
+                " (MSH_CGROUP can name a delegated one)" : "", instead);
+}
+
+char* findCgroupParent()
+/*where the jobs' cgroups go, NULL if cgroup v2 is not mounted: MSH_CGROUP,
+or the cgroup the shell started in. The controllers are enabled for its
+children, which only works if no process is in it but the root's, so a
+delegated MSH_CGROUP is the one that gets all of them*/
+{
+        char line[PATH_MAX + 256], mountPoint[PATH_MAX], *path = NULL;
+        FILE *file;
+
+        if (cgroupsChecked)
+                return cgroupParent;
+        cgroupsChecked = TRUE;
+        path = lookupVariable("MSH_CGROUP");
+        if (path != NULL && *path != '\0') {
+                cgroupParent = strdup(path);
+        } else if ((file = fopen("/proc/self/mountinfo", "re")) != NULL) {
+                mountPoint[0] = '\0';
+                while (fgets(line, sizeof(line), file) != NULL)
+                        if (strstr(line, " - cgroup2 ") != NULL
+                            && sscanf(line, "%*s %*s %*s %*s %4095s", mountPoint) == 1)
+                                break;
+                fclose(file);
+                if (mountPoint[0] != '\0' && (file = fopen("/proc/self/cgroup", "re")) != NULL) {
+                        while (fgets(line, sizeof(line), file) != NULL) {
+                                if (strncmp(line, "0::", 3) != 0)
+                                        continue;
+                                line[strcspn(line, "\n")] = '\0';
+                                cgroupParent = malloc(strlen(mountPoint) + strlen(line));
+                                sprintf(cgroupParent, "%s%s", mountPoint,
+                                        strcmp(line + 3, "/") == 0 ? "" : line + 3);
+                        }
+                        fclose(file);
+                }
+        }
+        if (cgroupParent != NULL) {//each on its own, one may be missing
+                writeCgroupFile(cgroupParent, "cgroup.subtree_control", "+memory");
+                writeCgroupFile(cgroupParent, "cgroup.subtree_control", "+cpu");
+                writeCgroupFile(cgroupParent, "cgroup.subtree_control", "+pids");
+        }
+        return cgroupParent;
+}
+
+int writeCgroupFile(const char *cgroup, const char *name, const char *value)//0 or -1
+{
+        char path[strlen(cgroup) + strlen(name) + 2];
+        sprintf(path, "%s/%s", cgroup, name);
+        int file = open(path, O_WRONLY | O_CLOEXEC);
+        if (file == -1)
+                return -1;
+        ssize_t count = write(file, value, strlen(value));
+        close(file);
+        return count == (ssize_t) strlen(value) ? 0 : -1;
+}
+
+void enterLimits(t_limits* limits)
+/*in every forked process of the job, before its exec. The hard limit is
+lowered too, so the command cannot raise it again*/
+{
+        struct rlimit limit;
+        if (limits->procsDescriptor != -1 && write(limits->procsDescriptor, "0", 1) == -1)
+                perror("limit: cgroup.procs");
+        for (int i = 0; i < limits->numResources; i++) {
+                rlim_t value = limits->values[i];
+                if (getrlimit(limits->resources[i], &limit) == 0 && value > limit.rlim_max)
+                        value = limit.rlim_max;//only root may go above it
+                limit.rlim_cur = limit.rlim_max = value;
+                if (setrlimit(limits->resources[i], &limit) == -1)
+                        perror("limit: setrlimit");
+        }
+        if (limits->hasCpus && sched_setaffinity(0, sizeof(cpu_set_t), &limits->affinity) == -1)
+                perror("limit: sched_setaffinity");
+        if (limits->numaNode != -1) {
+                unsigned long nodes[1024 / (8 * sizeof(unsigned long))] = { 0 };
+                nodes[limits->numaNode / (8 * sizeof(unsigned long))] |=
+                        1UL << (limits->numaNode % (8 * sizeof(unsigned long)));
+                if (syscall(SYS_set_mempolicy, MPOL_BIND, nodes, 8 * sizeof(nodes)) == -1)
+                        perror("limit: set_mempolicy");
+        }
+}
+
+void removeJobCgroup(t_job* job)//once the job is gone; busy if it left something behind
+{
+        if (job->cgroup == NULL)
+                return;
+        rmdir(job->cgroup);
+        free(job->cgroup);
+        job->cgroup = NULL;
+}
+
+void printJobPlacement(t_job* job)//a row under the job's in printJobs()
+{
+        char text[128];
+        snprintf(text, sizeof(text), "runs on %s", job->placement);
+        printf("| %7s  | %-60.60s |\n", "", text);
+}
+
+void printJobPressure(t_job* job)//a row under the job's in printJobs()
+{
+        char text[128], cpu[16] = "-", memory[16] = "-";
+        double pressure;
+        if ((pressure = readPressure(job->cgroup, "cpu.pressure")) >= 0)
+                snprintf(cpu, sizeof(cpu), "%.2f%%", pressure);
+        if ((pressure = readPressure(job->cgroup, "memory.pressure")) >= 0)
+                snprintf(memory, sizeof(memory), "%.2f%%", pressure);
+        snprintf(text, sizeof(text), "pressure over 10s: cpu %s, memory %s", cpu, memory);
+        printf("| %7s  | %-60.60s |\n", "", text);
+}
+
+double readPressure(const char *cgroup, const char *name)
+/*the share of the last 10 seconds some of the job's processes were stalled
+on the resource, from the cgroup's PSI file; -1 if it has none*/
+{
+        char path[strlen(cgroup) + strlen(name) + 2], text[256];
+        double pressure = -1;
+        sprintf(path, "%s/%s", cgroup, name);
+        int file = open(path, O_RDONLY | O_CLOEXEC);
+        if (file == -1)
+                return -1;
+        ssize_t count = read(file, text, sizeof(text) - 1);
+        close(file);
+        if (count > 0) {
+                text[count] = '\0';
+                if (sscanf(text, "some avg10=%lf", &pressure) != 1)
+                        pressure = -1;
+        }
+        return pressure;
+}
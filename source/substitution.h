@@ -0,0 +1,189 @@
+/*Command substitution. $(command) and `command` are left in the word like a
+reference by the lexer and replaced, when the word is expanded, by what the
+command writes, less the newlines at the end; unquoted, that is split into
+words like the value of a variable. The command runs in a forked copy of the
+shell writing into a pipe. A builtin that only prints, like jobs or history,
+runs in the shell itself instead, writing into a memfd: no fork at all*/
+
+const char* commandOutput(const char *text, size_t length)
+/*the output of the command in text. It stays in outputText until the next
+substitution, which is long enough for expandWord() to copy it*/
+{
+        t_parserState state;
+
+        saveParser(&state);
+        t_pipeline *pipeline = parseCommandLine(arenaCopy(text, length));
+        outputLength = 0;
+        if (pipeline != NULL && numHereDocuments > 0) {
+                fprintf(stderr, "MSH: no here-documents in a command substitution\n");
+                lastExitStatus = 2;
+        } else if (pipeline != NULL && printsOnly(pipeline)) {
+                expandPipeline(pipeline);
+                captureBuiltIn(pipeline->commands);
+        } else if (pipeline != NULL) {
+                captureSubshell(pipeline);
+        }
+        restoreParser(&state);
+        while (outputLength > 0 && outputText[outputLength - 1] == '\n')
+                outputLength--;
+        if (outputText == NULL)
+                outputText = malloc(outputCapacity = 2 * READ_CHUNK_LENGTH);
+        outputText[outputLength] = '\0';
+        return outputText;
+}
+
+int printsOnly(t_pipeline* pipeline)
+/*whether the line is one builtin that changes nothing in the shell, so
+running it in the shell is the same as in a copy*/
+{
+        t_command *command = pipeline->commands;
+        if (pipeline->next != NULL || pipeline->numCommands != 1 || pipeline->timed
+            || pipeline->executionMode != FOREGROUND || command->argc == 0
+            || command->numAssignments > 0 || strpbrk(command->argv[0], "\001\002\003"))
+                return FALSE;
+        char *name = command->argv[0];
+        if (strcmp(name, "jobs") == 0 || strcmp(name, "history") == 0)
+                return TRUE;
+        if (strcmp(name, "hash") == 0 || strcmp(name, "export") == 0)
+                return command->argc == 1;//listing, not changing the table
+        return strcmp(name, "kill") == 0 && command->argc == 2
+               && strcmp(command->argv[1], "-l") == 0;
+}
+
+void captureBuiltIn(t_command* command)//runs it with its output in a memfd
+{
+        int memoryFile = memfd_create("msh-output", MFD_CLOEXEC);
+        if (memoryFile == -1) {
+                perror("MSH: memfd_create");
+                lastExitStatus = 1;
+                return;
+        }
+        handleChildEvents();//its Done notifications are not part of the output
+        fflush(stdout);
+        int savedOutput = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(memoryFile, STDOUT_FILENO);
+        outputCaptured = TRUE;
+        runBuiltIn(command);
+        fflush(stdout);
+        outputCaptured = FALSE;
+        dup2(savedOutput, STDOUT_FILENO);
+        close(savedOutput);
+        lseek(memoryFile, 0, SEEK_SET);
+        readOutput(memoryFile);
+        close(memoryFile);
+}
+
+void captureSubshell(t_pipeline* pipeline)
+/*runs the line in a forked copy of the shell, with its output in a pipe. The
+copy has no terminal and no event writer of its own*/
+{
+        int pipeDescriptors[2];
+        int terminationStatus;
+
+        if (pipe2(pipeDescriptors, O_CLOEXEC) == -1) {
+                perror("MSH: pipe");
+                lastExitStatus = 1;
+                return;
+        }
+        fflush(stdout);//or the copy writes it out once more
+        pid_t pid = fork();
+        if (pid == -1) {
+                perror("MSH: fork");
+                close(pipeDescriptors[0]);
+                close(pipeDescriptors[1]);
+                lastExitStatus = 1;
+                return;
+        }
+        if (pid == 0) {
+                dup2(pipeDescriptors[1], STDOUT_FILENO);
+                MSH_IS_INTERACTIVE = FALSE;
+                eventsEnabled = FALSE;
+                commandLine = pipeline;
+                handleUserCommand();
+                fflush(stdout);
+                _exit(lastExitStatus);
+        }
+        close(pipeDescriptors[1]);
+        readOutput(pipeDescriptors[0]);
+        close(pipeDescriptors[0]);
+        while (waitpid(pid, &terminationStatus, 0) == -1 && errno == EINTR)
+                ;
+        lastExitStatus = jobExitStatus(terminationStatus);
+}
+
+void readOutput(int descriptor)
+/*appends all there is to read from descriptor to outputText. Each read goes
+straight into the free end of the buffer, which doubles when it is full, so a
+large output is copied a few times at most. NUL bytes are dropped, as the
+words cannot hold them*/
+{
+        ssize_t count;
+        while (TRUE) {
+                if (outputCapacity - outputLength < READ_CHUNK_LENGTH) {
+                        outputCapacity = outputCapacity ? 2 * outputCapacity : 2 * READ_CHUNK_LENGTH;
+                        outputText = realloc(outputText, outputCapacity);
+                }
+                count = read(descriptor, outputText + outputLength,
+                             outputCapacity - outputLength - 1);
+                if (count == -1 && errno == EINTR)
+                        continue;
+                if (count <= 0)
+                        break;
+                char *start = outputText + outputLength;
+                char *zero = memchr(start, '\0', count);
+                if (zero != NULL) {
+                        char *end = start + count, *to = zero;
+                        for (char *from = zero; from < end; from++)
+                                if (*from != '\0')
+                                        *to++ = *from;
+                        count = to - start;
+                }
+                outputLength += count;
+        }
+}
+
+void saveParser(t_parserState* state)
+/*parsing the command of a substitution starts with buffers of its own, the
+outer ones are still being filled*/
+{
+        state->lexerPosition = lexerPosition;
+        state->tokenStart = tokenStart;
+        state->tokenText = tokenText;
+        state->tokenQuoted = tokenQuoted;
+        state->tokenExpands = tokenExpands;
+        state->tokenAssignment = tokenAssignment;
+        state->parsedToken = parsedToken;
+        state->redirectType = redirectType;
+        state->redirectDescriptor = redirectDescriptor;
+        state->wordBuffer = wordBuffer;
+        state->wordLength = wordLength;
+        state->wordCapacity = wordCapacity;
+        state->arguments = arguments;
+        state->argumentsCapacity = argumentsCapacity;
+        state->commandLine = commandLine;
+        wordBuffer = NULL;
+        wordLength = wordCapacity = 0;
+        arguments = NULL;
+        argumentsCapacity = 0;
+}
+
+void restoreParser(t_parserState* state)
+{
+        free(wordBuffer);
+        free(arguments);
+        lexerPosition = state->lexerPosition;
+        tokenStart = state->tokenStart;
+        tokenText = state->tokenText;
+        tokenQuoted = state->tokenQuoted;
+        tokenExpands = state->tokenExpands;
+        tokenAssignment = state->tokenAssignment;
+        parsedToken = state->parsedToken;
+        redirectType = state->redirectType;
+        redirectDescriptor = state->redirectDescriptor;
+        wordBuffer = state->wordBuffer;
+        wordLength = state->wordLength;
+        wordCapacity = state->wordCapacity;
+        arguments = state->arguments;
+        argumentsCapacity = state->argumentsCapacity;
+        commandLine = state->commandLine;
+}
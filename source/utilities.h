@@ -8,7 +8,7 @@ void init()
         MSH_TERMINAL = STDIN_FILENO;
 		/*MSH_Terminal is static int STDIN_FILENO is a file descriptor 
 		used with lower level functions like read().*/
-        MSH_IS_INTERACTIVE = isatty(MSH_TERMINAL);
+        MSH_IS_INTERACTIVE = !MSH_BATCH_MODE && isatty(MSH_TERMINAL);
         /*isatty function returns 1 if filedes is a file descriptor associated 
 		with an open terminal device, and 0 otherwise.
 		isatty() call used to determine if the program is being run interactively
@@ -45,7 +45,6 @@ void init()
                 signal(SIGTTIN, SIG_IGN);
                 signal(SIGTSTP, SIG_IGN);
                 signal(SIGINT, SIG_IGN);
-                signal(SIGCHLD, &signalHandler_child);
 
                 setpgid(MSH_PID, MSH_PID);
                 MSH_PGID = getpgrp();
@@ -53,14 +52,75 @@ void init()
                         printf("Error, the shell is not process group leader");
                         exit(EXIT_FAILURE);
                 }
-                if (tcsetpgrp(MSH_TERMINAL, MSH_PGID) == -1)
-                        tcgetattr(MSH_TERMINAL, &MSH_TMODES);
+                tcsetpgrp(MSH_TERMINAL, MSH_PGID);
+                tcgetattr(MSH_TERMINAL, &MSH_TMODES);//restored after every foreground job
+                /*Keys reach the line editor one by one and unechoed; output
+                processing stays on so "\n" still starts a new line*/
+                MSH_EDITOR_TMODES = MSH_TMODES;
+                MSH_EDITOR_TMODES.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+                MSH_EDITOR_TMODES.c_iflag &= ~(IXON | ICRNL | INLCR);
+                MSH_EDITOR_TMODES.c_cc[VMIN] = 1;
+                MSH_EDITOR_TMODES.c_cc[VTIME] = 0;
+                sigset_t resize;
+                sigemptyset(&resize);
+                sigaddset(&resize, SIGWINCH);
+                sigprocmask(SIG_BLOCK, &resize, NULL);//jobs start with no signal blocked
+                MSH_RESIZE_FD = signalfd(-1, &resize, SFD_NONBLOCK | SFD_CLOEXEC);
 
-                currentDirectory = (char*) calloc(1024, sizeof(char));
+                loadHistory();//scripts neither read nor add to it
         } else {
-                printf("Could not make MSH interactive. Exiting..\n");
+                /*Scripts, -c commands and piped input run without job
+                control: jobs stay in the shell's process group and never
+                touch the terminal, like in any other non-interactive shell*/
+                MSH_PGID = getpgrp();
+        }
+        /*Instead of a SIGCHLD handler racing with the job list, the
+        signal is blocked and read from a signalfd, which can be polled
+        together with anything else the shell is waiting for*/
+        char *launcher = lookupVariable("MSH_LAUNCH");
+        MSH_USE_SPAWN = !(launcher != NULL && strcmp(launcher, "fork") == 0);
+
+        sigemptyset(&MSH_CHILD_MASK);
+        sigaddset(&MSH_CHILD_MASK, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &MSH_CHILD_MASK, NULL);
+        MSH_CHILD_FD = signalfd(-1, &MSH_CHILD_MASK, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (MSH_CHILD_FD == -1) {
+                perror("MSH");
                 exit(EXIT_FAILURE);
         }
+
+        /*$PWD is taken if it really is the current directory, so a path
+        reached through a symbolic link is shown the way it was typed*/
+        struct stat here, claimed;
+        char *directory = lookupVariable("PWD");
+        if (directory != NULL && directory[0] == '/' && stat(".", &here) == 0
+            && stat(directory, &claimed) == 0 && here.st_dev == claimed.st_dev
+            && here.st_ino == claimed.st_ino)
+                currentDirectory = strdup(directory);
+        else if ((currentDirectory = getcwd(NULL, 0)) == NULL)
+                currentDirectory = strdup(".");
+        startEventWriter();//if MSH_EVENT_LOG or MSH_METRICS_SOCKET is set
+}
+
+void parseArguments(int argc, char **argv)//msh [-c command | script]
+{
+        if (argc == 1)
+                return;//commands come from stdin, interactive if it is a terminal
+        if (strcmp(argv[1], "-c") == 0 && argc == 3) {
+                /*The command string is read back through the same line reader
+                as everything else*/
+                MSH_INPUT = openDataDescriptor(argv[2], strlen(argv[2]), TRUE);
+        } else if (argv[1][0] != '-' && argc == 2) {
+                MSH_INPUT = open(argv[1], O_RDONLY | O_CLOEXEC);
+                if (MSH_INPUT == -1) {
+                        fprintf(stderr, "MSH: %s: %s\n", argv[1], strerror(errno));
+                        exit(127);
+                }
+        } else {
+                fprintf(stderr, "usage: %s [-c command | script]\n", argv[0]);
+                exit(2);
+        }
+        MSH_BATCH_MODE = TRUE;
 }
 
 void welcomeScreen()
@@ -72,81 +132,217 @@ void welcomeScreen()
         printf("\n\n");
 }
 
-void shellPrompt()
+void shellPrompt()//see prompt.h
 {
-        printf("%s \\m/ ",getcwd(currentDirectory, 1024));
-		/*Prompt symbol of our shell is '\m/'
-		The getcwd function(in unistd.h) returns an absolute file name representing the 
-		current working directory, storing it in the character array buffer(currentDirectory)
-		that we provide.The size argument is how we tell the system the allocation 
-		size of buffer.
-		*/
+        renderPrompt();
+        fputs(promptText, stdout);
+        fflush(stdout);//input is read() directly, so stdio will not flush it
 }
 
 
-void getTextLine()//get user's command
+int getTextLine()//get user's command, returns EOF at the end of input
 {
         destroyCommand();//delete previous command from processing buffer
-        while ((userInput != '\n') && (bufferChars < BUFFER_MAX_LENGTH)) {
-                buffer[bufferChars++] = userInput;
-                userInput = getchar();
+        if (readLine() == EOF)
+                return EOF;
+        populateCommand();
+        return bufferChars;
+}
+
+int readLine()//reads the next line of input into buffer, EOF at the end of input
+{
+        long maxLength = sysconf(_SC_ARG_MAX);
+        int tooLong = FALSE;
+
+        if (MSH_IS_INTERACTIVE)
+                return editLine();//see editor.h
+        bufferChars = 0;
+        while (TRUE) {
+                if (readStart == readEnd) {
+                        ssize_t count = read(MSH_INPUT, readBuffer, READ_CHUNK_LENGTH);
+                        if (count == -1 && errno == EINTR)
+                                continue;
+                        if (count <= 0) {
+                                if (bufferChars == 0 && !tooLong)
+                                        return EOF;
+                                break;//last line without a newline
+                        }
+                        readStart = 0;
+                        readEnd = count;
+                }
+                /*Copy everything up to the newline (or the whole chunk) at once*/
+                char *start = readBuffer + readStart;
+                char *newline = memchr(start, '\n', readEnd - readStart);
+                size_t length = newline ? (size_t) (newline - start) : readEnd - readStart;
+                readStart += length + (newline != NULL);
+                if (!tooLong && bufferChars + length >= (size_t) maxLength) {
+                        fprintf(stderr, "MSH: command line longer than %ld bytes\n",
+                                maxLength);
+                        tooLong = TRUE;
+                }
+                if (!tooLong) {
+                        if (bufferChars + length + 1 > bufferCapacity) {
+                                while (bufferChars + length + 1 > bufferCapacity)
+                                        bufferCapacity = bufferCapacity ?
+                                                         2 * bufferCapacity : 256;
+                                buffer = realloc(buffer, bufferCapacity);
+                        }
+                        memcpy(buffer + bufferChars, start, length);
+                        bufferChars += length;
+                }
+                if (newline != NULL)
+                        break;
         }
+        if (tooLong)
+                bufferChars = 0;
+        if (buffer == NULL)
+                buffer = malloc(bufferCapacity = 256);
         buffer[bufferChars] = 0x00;//it means a NULL pointer.Trying to access this data raises a Segmentation Fault
-        populateCommand();
+        return bufferChars;
 }
 
 void destroyCommand()//to be used in getTextLine
 {
-        while (commandArgc != 0) {
-                commandArgv[commandArgc] = NULL;
-                commandArgc--;
-        }
+        arenaReset();//the previous line's command tree goes all at once
+        commandLine = NULL;
+        commandArgc = 0;
         bufferChars = 0;
 }
 
 void populateCommand()
-/*breaks the user stored text in buffer appropriately and stores that in global 
-array of strings commandArgc
-*/ 
+/*parses the line stored in buffer into commandLine, see parser.h*/
 {
-        char* bufferPointer;
-        bufferPointer = strtok(buffer, " ");
-		/*char *strtok(char *str, const char *delim) 
-		breaks string str into a series of tokens using the delimitrer delim.*/
-        while (bufferPointer != NULL) {
-                commandArgv[commandArgc] = bufferPointer;//points to bufferpointer string
-                bufferPointer = strtok(NULL, " ");//collect next token in buffer pointer
-                commandArgc++;
+        if (MSH_IS_INTERACTIVE) {
+                if (!expandHistory())//!! and !n
+                        return;
+                addHistory(buffer, bufferChars);
         }
+        commandLine = parseCommandLine(buffer);
+        if (commandLine != NULL)
+                readHereDocuments();//the tree no longer points into buffer
 }
 
-void handleUserCommand()
+void handleUserCommand()//runs the pipelines of the line one after the other
 {
-/*check whether command belongs to built in commands defined by us*/
-        if (checkBuiltInCommands() == 0) {
-                launchJob(commandArgv, "STANDARD", 0, FOREGROUND);                              
+        globLine++;//directories listed for an earlier line are checked again
+        for (t_pipeline *pipeline = commandLine; pipeline != NULL;
+             pipeline = pipeline->next) {
+                if ((pipeline->connector == CONNECT_AND && lastExitStatus != 0)
+                    || (pipeline->connector == CONNECT_OR && lastExitStatus == 0))
+                        continue;//a && b || c: skipping b keeps a's status for c
+                expandPipeline(pipeline);//with the values variables have by now
+                if (pipeline->timed)
+                        timeCommand(pipeline);
+                else
+                        runPipeline(pipeline);
+        }
+}
+
+void runPipeline(t_pipeline* pipeline)
+{
+        t_command *command = pipeline->commands;
+/*a builtin on its own runs in the shell itself, redirected or not; in a
+pipeline or in the background it is left to launchJob(), which runs it in a
+forked copy of the shell*/
+        if (pipeline->numCommands == 1 && pipeline->executionMode == FOREGROUND
+            && pipeline->limits == NULL && (command->argc == 0 || isBuiltInCommand(command->argv[0]))) {
+                runBuiltIn(command);
+                return;
         }
+        launchJob(pipeline);
+        if (pipeline->executionMode == BACKGROUND)
+                lastExitStatus = 0;
+}
+
+void runBuiltIn(t_command* command)//runs a builtin in the shell process itself
+{
+        int numSaved = 0;
+        int *saved = NULL;
+
+        lastExitStatus = 0;
+        if (command->redirections != NULL) {
+                /*The shell's own descriptors are moved out of the way and put
+                back afterwards, so cd > log still changes the shell's directory*/
+                if (openRedirections(command) == -1)
+                        return;
+                for (t_redirection *redirection = command->redirections; redirection != NULL;
+                     redirection = redirection->next)
+                        numSaved++;
+                saved = arenaAlloc(numSaved * sizeof(int));
+                numSaved = 0;
+                fflush(stdout);
+                for (t_redirection *redirection = command->redirections; redirection != NULL;
+                     redirection = redirection->next)
+                        saved[numSaved++] = fcntl(redirection->descriptor, F_DUPFD_CLOEXEC, 10);
+                if (applyRedirections(command) == -1)
+                        lastExitStatus = 1;
+        }
+        if (lastExitStatus == 0)
+                assignVariables(command);
+        commandArgv = command->argv;
+        commandArgc = command->argc;
+        if (lastExitStatus == 0 && command->argc > 0
+            && checkBuiltInCommands() == 0)//missing arguments
+                lastExitStatus = 1;
+        if (saved == NULL)
+                return;
+        fflush(stdout);
+        t_redirection *redirection = command->redirections;
+        for (int i = 0; i < numSaved; i++, redirection = redirection->next) {
+                if (saved[i] == -1) {//it was not open before
+                        close(redirection->descriptor);
+                        continue;
+                }
+                dup2(saved[i], redirection->descriptor);
+                close(saved[i]);
+        }
+        closeRedirections(command);
+}
+
+void timeCommand(t_pipeline* pipeline)//time prefix: runs the pipeline and reports its usage
+{
+        struct rusage before, after;
+        struct timespec started;
+
+        lastForegroundFinished = FALSE;
+        getrusage(RUSAGE_SELF, &before);
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        runPipeline(pipeline);
+        if (!lastForegroundFinished) {
+                /*a builtin, or a job that was stopped: report what the shell
+                itself used meanwhile*/
+                getrusage(RUSAGE_SELF, &after);
+                timersub(&after.ru_utime, &before.ru_utime, &lastForegroundUsage.ru_utime);
+                timersub(&after.ru_stime, &before.ru_stime, &lastForegroundUsage.ru_stime);
+                lastForegroundUsage.ru_maxrss = after.ru_maxrss;
+                lastForegroundUsage.ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+                lastForegroundUsage.ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+                lastForegroundWall = secondsSince(&started);
+        }
+        fprintf(stderr, "\nreal\t%.3fs\nuser\t%ld.%03lds\nsys\t%ld.%03lds\n"
+                "maxrss\t%ld KB\nctxsw\t%ld voluntary, %ld involuntary\n",
+                lastForegroundWall,
+                (long) lastForegroundUsage.ru_utime.tv_sec,
+                (long) lastForegroundUsage.ru_utime.tv_usec / 1000,
+                (long) lastForegroundUsage.ru_stime.tv_sec,
+                (long) lastForegroundUsage.ru_stime.tv_usec / 1000,
+                lastForegroundUsage.ru_maxrss, lastForegroundUsage.ru_nvcsw,
+                lastForegroundUsage.ru_nivcsw);
 }
 
 int checkBuiltInCommands()
 {
         if (strcmp("exit", commandArgv[0]) == 0) {//exit from terminal
-                exit(EXIT_SUCCESS);
+                exit(commandArgv[1] ? atoi(commandArgv[1]) : lastExitStatus);
         }
         if (strcmp("cd", commandArgv[0]) == 0) {//change the directory
 
                 changeDirectory();//defined below
                 return 1;
         }
-        if (strcmp("bg", commandArgv[0]) == 0) {//start a job in background
-                if (commandArgv[1] == NULL)
-                        return 0;
-                if (strcmp("in", commandArgv[1]) == 0)
-                        launchJob(commandArgv + 3, *(commandArgv + 2), STDIN, BACKGROUND);
-                else if (strcmp("out", commandArgv[1]) == 0)
-                        launchJob(commandArgv + 3, *(commandArgv + 2), STDOUT, BACKGROUND);
-                else
-                        launchJob(commandArgv + 1, "STANDARD", 0, BACKGROUND);
+        if (strcmp("bg", commandArgv[0]) == 0) {//bg with a command is parsed as a background job
+                printf("usage: bg [in file | out file] command\n");
+                lastExitStatus = 2;
                 return 1;
         }
         if (strcmp("fg", commandArgv[0]) == 0) {
@@ -163,15 +359,57 @@ int checkBuiltInCommands()
                 return 1;
         }
         if (strcmp("jobs", commandArgv[0]) == 0) {
-                printJobs();
+                if (!outputCaptured)//captureBuiltIn() did it, with stdout still on the terminal
+                        handleChildEvents();//do not list jobs that already finished
+                if (commandArgv[1] != NULL && strcmp(commandArgv[1], "--json") == 0)
+                        printJobsListing(JOBS_JSON);
+                else if (commandArgv[1] != NULL && strcmp(commandArgv[1], "--tsv") == 0)
+                        printJobsListing(JOBS_TSV);
+                else
+                        printJobs(commandArgv[1] != NULL && strcmp(commandArgv[1], "-l") == 0);
                 return 1;
         }
-        if (strcmp("kill", commandArgv[0]) == 0)
-        {
-                if (commandArgv[1] == NULL)
-                        return 0;
-                
-                killJob(atoi(commandArgv[1]));
+        if (strcmp("kill", commandArgv[0]) == 0) {
+                killJobs();
+                return 1;
+        }
+        if (strcmp("wait", commandArgv[0]) == 0) {
+                waitJobs();
+                return 1;
+        }
+        if (strcmp("parallel", commandArgv[0]) == 0) {
+                runParallel(commandArgv + 1);
+                return 1;
+        }
+        if (strcmp("history", commandArgv[0]) == 0) {//history [n] or history -s text
+                if (commandArgv[1] != NULL && strcmp(commandArgv[1], "-s") == 0) {
+                        if (commandArgv[2] == NULL)
+                                return 0;
+                        searchHistory(commandArgv[2]);
+                } else {
+                        printHistory(commandArgv[1] ? atoi(commandArgv[1]) : 0);
+                }
+                return 1;
+        }
+        if (strcmp("export", commandArgv[0]) == 0) {
+                exportVariables();
+                return 1;
+        }
+        if (strcmp("unset", commandArgv[0]) == 0) {
+                unsetVariables();
+                return 1;
+        }
+        if (strcmp("hash", commandArgv[0]) == 0) {//hash [-r] [name...]
+                if (commandArgv[1] == NULL) {
+                        printCommandCache();
+                        return 1;
+                }
+                for (int i = 1; commandArgv[i] != NULL; i++) {
+                        if (strcmp(commandArgv[i], "-r") == 0)
+                                clearCommandCache();
+                        else if (resolveCommand(commandArgv[i]) == NULL)
+                                printf("hash: %s: not found\n", commandArgv[i]);
+                }
                 return 1;
         }
         return 0;
@@ -180,28 +418,75 @@ int checkBuiltInCommands()
 
 void changeDirectory()//to change the current working directory
 {
-        if (commandArgv[1] == NULL) {
-                chdir(getenv("HOME"));
-				/*in stdlib.h The C library function char *getenv(const char *name)
-				searches for the environment string pointed to by name 
-				and returns the associated value to the string.*/
-        } else {
-                if (chdir(commandArgv[1]) == -1) {
-                        printf(" %s: no such directory\n", commandArgv[1]);
-					/*The chdir() function makes the directory named by path 
-					the new current directory.
-					If the chdir() function fails, the current directory is 
-					unchanged.returns -1 when fails
-					*/
+        char *target = commandArgv[1] != NULL ? commandArgv[1] : lookupVariable("HOME");
+        if (target == NULL)
+                return;
+        /*the directory is followed the way it was named; chdir() to the
+        name as typed is the fallback when that path does not work out*/
+        char *directory = logicalPath(target);
+        if (chdir(directory) == -1) {
+                free(directory);
+                directory = NULL;
+                if (chdir(target) == -1) {
+                        printf(" %s: no such directory\n", target);
+                        lastExitStatus = 1;
+                        return;
                 }
+                if ((directory = getcwd(NULL, 0)) == NULL)
+                        directory = strdup(target);
         }
+        free(currentDirectory);
+        currentDirectory = directory;
+        setVariable("PWD", 3, currentDirectory, TRUE);
 }
 
-void launchJob(char *command[], char *file, int newDescriptor,
-               int executionMode)
+void launchJob(t_pipeline* pipeline)
 {
         pid_t pid;
-        pid = fork();
+        pid_t pgid = 0;
+        t_job* job = NULL;
+        int inputDescriptor = -1;//read end of the pipe from the previous stage
+        int executionMode = pipeline->executionMode;
+        char *descriptor = pipeline->backgroundFile ? pipeline->backgroundFile : "STANDARD";
+        sigset_t signals;
+        int pipeDescriptors[2];
+        struct timespec launched;
+        t_limits limits;
+
+        clearLimits(&limits);
+        if (pipeline->limits != NULL) {
+                if (parseLimits(pipeline->limits, &limits) == -1) {
+                        lastExitStatus = 2;
+                        return;
+                }
+                makeJobCgroup(&limits);
+        }
+        /*a job with limits or a placement is set up by each of its processes*/
+        int limited = placeJob(&limits, executionMode) || pipeline->limits != NULL;
+        fflush(stdout);//children must not inherit unwritten output
+        /*Every stage of a pipeline is a separate child, but all of them share
+        the process group of the first one, so the pipeline is a single job
+        for the terminal, for fg and for kill*/
+        for (t_command *command = pipeline->commands; command != NULL;
+             command = command->next) {
+                int lastStage = (command->next == NULL);
+                if (!lastStage && pipe2(pipeDescriptors, O_CLOEXEC) == -1) {
+                        perror("MSH");
+                        break;
+                }
+                /*Commands are started with posix_spawn(), which does not copy
+                the shell's page tables; only stages that need a copy of the
+                shell itself, such as builtins inside a pipeline, are forked. So
+                are the stages of a limited job: they set the limits themselves*/
+                int spawned = MSH_USE_SPAWN && !limited && !needsForkedShell(command);
+                clock_gettime(CLOCK_MONOTONIC, &launched);
+                if (openRedirections(command) == -1)
+                        pid = -1;//a stage that cannot be redirected is not started
+                else if (spawned)
+                        pid = spawnProcess(command, executionMode, pgid, inputDescriptor,
+                                           lastStage ? -1 : pipeDescriptors[1]);
+                else if ((pid = fork()) == -1)
+                        perror("MSH");
 		/*In unistd.h int fork() turns a single process into 2 identical processes,
 		known as the parent and the child.
 		On success, fork() returns 0 to the child process and 
@@ -209,145 +494,554 @@ void launchJob(char *command[], char *file, int newDescriptor,
 		On failure,fork() returns -1 to the parent process, 
 		sets errno to indicate the error, and no child process is created. 
 		*/
-        switch (pid) {
-        case -1:
-                perror("MSH");
-                exit(EXIT_FAILURE);
-                break;
-        case 0://executing child process
-                /*
-				Macros like SIGINT, SIGQUIT, etc are defined in <signal.h> 
-				header file for common signals. 
-				*/
-				signal(SIGINT, SIG_DFL);
-                signal(SIGQUIT, SIG_DFL);
-                signal(SIGTSTP, SIG_DFL);
-                signal(SIGCHLD, &signalHandler_child);
-                signal(SIGTTIN, SIG_DFL);
-                setpgrp();
-				/*If the process is not already a session leader, 
-				setpgrp() sets the process group ID of the calling process 
-				to the process ID of the calling process.*/
-                if (executionMode == FOREGROUND)
-                        tcsetpgrp(MSH_TERMINAL, getpid());
-				
-                if (executionMode == BACKGROUND)
-                      printf("[%d] %d\n", ++numActiveJobs, (int) getpid());
+                switch (pid) {
+                case -1://already reported, the other stages still run
+                        break;
+                case 0://executing child process
+                        /*
+                        Macros like SIGINT, SIGQUIT, etc are defined in <signal.h> 
+                        header file for common signals. 
+                        */
+                        signal(SIGINT, SIG_DFL);
+                        signal(SIGQUIT, SIG_DFL);
+                        signal(SIGTSTP, SIG_DFL);
+                        signal(SIGTTIN, SIG_DFL);
+                        signal(SIGTTOU, SIG_DFL);
+                        sigemptyset(&signals);//the shell's blocked signals survive exec
+                        sigprocmask(SIG_SETMASK, &signals, NULL);
+                        if (MSH_IS_INTERACTIVE) {
+                                setpgid(0, pgid);
+                                /*With pgid 0 the first stage becomes the leader of a
+                                new process group; later stages join that group*/
+                                if (executionMode == FOREGROUND)
+                                        tcsetpgrp(MSH_TERMINAL, pgid ? pgid : getpid());
+                        }
 
-                //to execute a command
-				executeCommand(command, file, newDescriptor, executionMode);
+                        /*The pipe descriptors are O_CLOEXEC, only the dup2'd
+                        copies on stdin/stdout survive the exec*/
+                        if (inputDescriptor != -1)
+                                dup2(inputDescriptor, STDIN_FILENO);
+                        if (!lastStage)
+                                dup2(pipeDescriptors[1], STDOUT_FILENO);
+                        if (limited)
+                                enterLimits(&limits);
 
-                exit(EXIT_SUCCESS);
-                shellPrompt();
-                break;
-        default://executing parent process
-                setpgid(pid, pid);
+                        //to execute a command
+                        executeCommand(command);//does not return
+                        break;
+                default://executing parent process
+                        if (pgid == 0)
+                                pgid = pid;
+                        if (MSH_IS_INTERACTIVE)
+                                setpgid(pid, pgid);
 
-                //insert the job in global array of job list being maintained
-				jobsList = insertJob(pid, pid, *(command), file, (int) executionMode);
+                        //insert the job in the global job table being maintained
+                        if (job == NULL)
+                                job = insertJob(pid, pgid, pipeline->text, descriptor,
+                                                (int) executionMode);
+                        else
+                                addJobProcess(job, pid);
+                        recordJobEvent(spawned ? EVENT_LAUNCH : EVENT_FORK, job, pid,
+                                       (long) (secondsSince(&launched) * 1e9));
+                        break;
+                }
+                closeRedirections(command);
+                if (inputDescriptor != -1)
+                        close(inputDescriptor);
+                inputDescriptor = -1;
+                if (!lastStage) {
+                        close(pipeDescriptors[1]);
+                        inputDescriptor = pipeDescriptors[0];
+                }
+        }
+        if (inputDescriptor != -1)
+                close(inputDescriptor);
+        if (job != NULL)
+                job->placement = describePlacement(&limits);
+        if (limits.cgroup != NULL) {
+                close(limits.procsDescriptor);
+                if (job != NULL) {
+                        job->cgroup = limits.cgroup;//removed with the job
+                } else {
+                        rmdir(limits.cgroup);
+                        free(limits.cgroup);
+                }
+        }
+        if (job == NULL)
+                return;
 
-                t_job* job = getJob(pid, BY_PROCESS_ID);
+        if (executionMode == BACKGROUND && MSH_IS_INTERACTIVE)
+                printf("[%d] %d\n", job->id, (int) job->pgid);
+        if (executionMode == FOREGROUND)
+                putJobForeground(job, FALSE);
+        if (executionMode == BACKGROUND)
+                putJobBackground(job, FALSE);
+}
 
-                if (executionMode == FOREGROUND) {
-                        putJobForeground(job, FALSE);
+int openRedirections(t_command* command)
+/*opens the files and here-documents of a command in the shell, so an open()
+that fails is reported before the command starts, and the child, forked or
+spawned, only has to dup2() descriptors. Returns -1, with everything closed
+again, if one cannot be opened*/
+{
+        for (t_redirection *redirection = command->redirections; redirection != NULL;
+             redirection = redirection->next) {
+                switch (redirection->type) {
+                case REDIRECT_INPUT:
+                        redirection->source = open(redirection->target, O_RDONLY | O_CLOEXEC);
+                        break;
+                case REDIRECT_OUTPUT:
+                        redirection->source = open(redirection->target, O_CREAT | O_TRUNC
+                                                   | O_WRONLY | O_CLOEXEC, 0666);
+                        break;
+                case REDIRECT_APPEND:
+                        redirection->source = open(redirection->target, O_CREAT | O_APPEND
+                                                   | O_WRONLY | O_CLOEXEC, 0666);
+                        break;
+                case REDIRECT_HERE_STRING:
+                case REDIRECT_HERE_DOCUMENT:
+                        redirection->source = openDataDescriptor(redirection->target,
+                                                                 strlen(redirection->target),
+                                                                 redirection->type ==
+                                                                 REDIRECT_HERE_STRING);
+                        break;
+                default:
+                        continue;//n>&m uses the descriptor as it is
+                }
+                if (redirection->source == -1) {
+                        if (redirection->type != REDIRECT_HERE_STRING
+                            && redirection->type != REDIRECT_HERE_DOCUMENT)
+                                fprintf(stderr, "MSH: %s: %s\n", redirection->target,
+                                        strerror(errno));
+                        closeRedirections(command);
+                        lastExitStatus = 1;
+                        return -1;
+                }
+                /*Keep clear of the low descriptors a later n>&m may write over*/
+                if (redirection->source < 10) {
+                        int moved = fcntl(redirection->source, F_DUPFD_CLOEXEC, 10);
+                        close(redirection->source);
+                        redirection->source = moved;
                 }
-                if (executionMode == BACKGROUND)
-                        putJobBackground(job, FALSE);
-                break;
         }
+        return 0;
 }
-void executeCommand(char *command[], char *file, int newDescriptor,
-                    int executionMode)
+
+void closeRedirections(t_command* command)//the child has its own copies by now
 {
-        int commandDescriptor;
-        if (newDescriptor == STDIN) {
-                commandDescriptor = open(file, O_RDONLY, 0600);
-				/*O_RDONLY for read only mode
-				Upon successful completion, the function shall open the file 
-				and return a non-negative integer representing the lowest numbered
-				unused file descriptor. Otherwise, -1 shall be returned and
-				errno set to indicate the error.
-				No files shall be created or modified if the function returns -1.
-				*/
-                dup2(commandDescriptor, STDIN_FILENO);
+        for (t_redirection *redirection = command->redirections; redirection != NULL;
+             redirection = redirection->next) {
+                if (redirection->type == REDIRECT_DUPLICATE)
+                        continue;//not the shell's to close
+                if (redirection->source != -1)
+                        close(redirection->source);
+                redirection->source = -1;
+        }
+}
+
+int applyRedirections(t_command* command)
+/*makes the redirections of a command, in order, on the descriptors of the
+calling process: the forked child, or the shell around a builtin*/
+{
+        for (t_redirection *redirection = command->redirections; redirection != NULL;
+             redirection = redirection->next) {
+                if (redirection->type == REDIRECT_DUPLICATE && redirection->source == -1) {
+                        close(redirection->descriptor);//n>&-
+                        continue;
+                }
+                if (redirection->source == redirection->descriptor) {//n>&n survives exec
+                        fcntl(redirection->descriptor, F_SETFD, 0);
+                        continue;
+                }
+                if (dup2(redirection->source, redirection->descriptor) == -1) {
 				/*system call
 				Using dup2(), we can redirect standard output to a file
 				dup2 returns the value of the second parameter (fildes2) upon success. 
 				A negative return value means that an error occured.
 				*/
-                close(commandDescriptor);
+                        fprintf(stderr, "MSH: %d: %s\n", redirection->source, strerror(errno));
+                        return -1;
+                }
         }
-        if (newDescriptor == STDOUT) {
-                commandDescriptor = open(file, O_CREAT | O_TRUNC | O_WRONLY, 0600);
-                dup2(commandDescriptor, STDOUT_FILENO);
-                close(commandDescriptor);
+        return 0;
+}
+
+int openDataDescriptor(const char *data, size_t length, int newline)
+/*returns a descriptor from which a child can read data, followed by a newline
+if asked to.
+The data goes from the shell's memory straight into a pipe, or into an
+anonymous memfd when it does not fit the pipe buffer, so no temp file is
+ever written to disk and the shell never blocks on a slow reader*/
+{
+        int descriptors[2];
+        struct iovec pieces[2] = { { (void*) data, length }, { "\n", newline ? 1 : 0 } };
+        size_t total = length + pieces[1].iov_len;
+
+        if (pipe2(descriptors, O_CLOEXEC) == 0) {
+                if (total <= (size_t) fcntl(descriptors[1], F_GETPIPE_SZ)
+                    && writev(descriptors[1], pieces, 2) == (ssize_t) total) {
+                        close(descriptors[1]);
+                        return descriptors[0];
+                }
+                close(descriptors[0]);
+                close(descriptors[1]);
         }
-        if (execvp(*command, command) == -1)
+        int memoryFile = memfd_create("msh-input", MFD_CLOEXEC);
+        if (memoryFile == -1) {
                 perror("MSH");
+                return -1;
+        }
+        while (total > 0) {
+                ssize_t written = writev(memoryFile, pieces, 2);
+                if (written <= 0)
+                        break;
+                total -= written;
+                for (int i = 0; i < 2; i++) {//skip what was already written
+                        size_t done = (size_t) written < pieces[i].iov_len ?
+                                      (size_t) written : pieces[i].iov_len;
+                        pieces[i].iov_base = (char*) pieces[i].iov_base + done;
+                        pieces[i].iov_len -= done;
+                        written -= done;
+                }
+        }
+        lseek(memoryFile, 0, SEEK_SET);
+        return memoryFile;
+}
+
+void executeCommand(t_command* command)
+{
+        if (applyRedirections(command) == -1)
+                _exit(1);
+        char **argv = command->argv;
+        if (command->argc == 0)//assignments in a pipeline are lost with the child
+                _exit(0);
+        if (isBuiltInCommand(*argv)) {//running in a forked copy of the shell
+                assignVariables(command);
+                commandArgv = argv;
+                commandArgc = command->argc;
+                checkBuiltInCommands();
+                fflush(stdout);
+                _exit(lastExitStatus);
+        }
+        char **envp = commandEnvironment(command);
+        char *path = resolveCommand(*argv);
+        if (path != NULL)
+                execve(path, argv, envp);
+        if (path == NULL || errno == ENOENT)//not hashed yet or gone since
+                execvpe(*argv, argv, envp);
+        int error = errno;
+        perror("MSH");
+        _exit(error == EACCES || error == ENOEXEC ? 126 : 127);//_exit so the shell's stdio buffers are not flushed twice
+}
+
+pid_t spawnProcess(t_command* command, int executionMode, pid_t pgid,
+                   int inputDescriptor, int outputDescriptor)
+/*does with posix_spawn() what the child branch of launchJob() and
+executeCommand() do after a fork. glibc starts the child with
+CLONE_VM | CLONE_VFORK, so no page tables are copied however large the
+shell grows, and reports a failed exec as the return value*/
+{
+        pid_t pid;
+        posix_spawnattr_t attributes;
+        posix_spawn_file_actions_t actions;
+        sigset_t signals;
+        short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+
+        posix_spawnattr_init(&attributes);
+        posix_spawn_file_actions_init(&actions);
+
+        sigemptyset(&signals);//the shell blocks SIGCHLD, the child must not
+        posix_spawnattr_setsigmask(&attributes, &signals);
+        sigaddset(&signals, SIGINT);//everything the shell ignores
+        sigaddset(&signals, SIGQUIT);
+        sigaddset(&signals, SIGTSTP);
+        sigaddset(&signals, SIGTTIN);
+        sigaddset(&signals, SIGTTOU);
+        sigaddset(&signals, SIGCHLD);
+        posix_spawnattr_setsigdefault(&attributes, &signals);
+        if (MSH_IS_INTERACTIVE) {
+                flags |= POSIX_SPAWN_SETPGROUP;
+                posix_spawnattr_setpgroup(&attributes, pgid);
+#if __GLIBC_PREREQ(2, 35)
+                if (executionMode == FOREGROUND)
+                        posix_spawn_file_actions_addtcsetpgrp_np(&actions, MSH_TERMINAL);
+#endif
+        }
+        posix_spawnattr_setflags(&attributes, flags);
+
+        if (inputDescriptor != -1)
+                posix_spawn_file_actions_adddup2(&actions, inputDescriptor, STDIN_FILENO);
+        if (outputDescriptor != -1)
+                posix_spawn_file_actions_adddup2(&actions, outputDescriptor, STDOUT_FILENO);
+        for (t_redirection *redirection = command->redirections; redirection != NULL;
+             redirection = redirection->next) {//see applyRedirections()
+                if (redirection->type == REDIRECT_DUPLICATE && redirection->source == -1)
+                        posix_spawn_file_actions_addclose(&actions, redirection->descriptor);
+                else
+                        posix_spawn_file_actions_adddup2(&actions, redirection->source,
+                                                         redirection->descriptor);
+        }
+
+        /*The absolute path comes from the command hash, so there is no
+        execve() probing of every PATH directory. A binary that vanished
+        since it was hashed is looked up once more*/
+        char **argv = command->argv;
+        char **envp = commandEnvironment(command);
+        int error = ENOENT;
+        char *path = resolveCommand(*argv);
+        if (path != NULL)
+                error = posix_spawn(&pid, path, &actions, &attributes, argv, envp);
+        if (error == ENOENT && path != NULL && strchr(*argv, '/') == NULL) {
+                forgetCommand(*argv);
+                path = resolveCommand(*argv);
+                if (path != NULL)
+                        error = posix_spawn(&pid, path, &actions, &attributes,
+                                            argv, envp);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+        if (error != 0) {
+                if (path == NULL)
+                        fprintf(stderr, "MSH: %s: command not found\n", *argv);
+                else
+                        fprintf(stderr, "MSH: %s: %s\n", *argv, strerror(error));
+                /*as after a fork: 127 when there is no such command, 126 when
+                it cannot be run, and 1 when a redirection failed, like >&5
+                with nothing open on 5*/
+                lastExitStatus = path == NULL || error == ENOENT ? 127 :
+                                 error == EACCES || error == ENOEXEC ? 126 : 1;
+                return -1;
+        }
+        return pid;
+}
+
+char* resolveCommand(char *name)
+/*returns the absolute path of a command, searching PATH only the first time
+a name is seen (or after PATH changed), NULL when it is not found*/
+{
+        if (strchr(name, '/') != NULL)
+                return name;
+        char *searchPath = lookupVariable("PATH");//setting it empties the cache
+        if (searchPath == NULL)
+                searchPath = "/bin:/usr/bin";
+
+        t_hashedCommand *entry = findHashedCommand(name);
+        if (entry->name != NULL) {
+                entry->hits++;
+                return entry->path;
+        }
+
+        char *path = NULL;
+        size_t nameLength = strlen(name);
+        for (char *directory = searchPath; path == NULL; ) {
+                char *end = strchr(directory, ':');
+                size_t length = end ? (size_t) (end - directory) : strlen(directory);
+                char *candidate = malloc(length + nameLength + 3);
+                if (length == 0)//an empty entry means the current directory
+                        sprintf(candidate, "./%s", name);
+                else
+                        sprintf(candidate, "%.*s/%s", (int) length, directory, name);
+                struct stat info;
+                if (stat(candidate, &info) == 0 && S_ISREG(info.st_mode)
+                    && access(candidate, X_OK) == 0)
+                        path = candidate;
+                else
+                        free(candidate);
+                if (end == NULL)
+                        break;
+                directory = end + 1;
+        }
+        if (path == NULL)
+                return NULL;
+
+        if (2 * (commandCacheCount + 1) > commandCacheCapacity) {
+                t_hashedCommand *oldCache = commandCache;
+                int oldCapacity = commandCacheCapacity;
+                commandCacheCapacity = oldCapacity ? 2 * oldCapacity : 64;
+                commandCache = calloc(commandCacheCapacity, sizeof(t_hashedCommand));
+                for (int i = 0; i < oldCapacity; i++)
+                        if (oldCache[i].name != NULL)
+                                *findHashedCommand(oldCache[i].name) = oldCache[i];
+                free(oldCache);
+                entry = findHashedCommand(name);
+        }
+        entry->name = strdup(name);
+        entry->path = path;
+        entry->hits = 1;
+        commandCacheCount++;
+        return path;
+}
+
+t_hashedCommand* findHashedCommand(char *name)
+/*the slot holding name, or the empty slot where it would go*/
+{
+        static t_hashedCommand none;
+        if (commandCacheCapacity == 0)
+                return &none;
+        unsigned int hash = 5381;
+        for (char *c = name; *c; c++)
+                hash = hash * 33 + (unsigned char) *c;
+        unsigned int mask = commandCacheCapacity - 1;
+        unsigned int slot = hash & mask;
+        while (commandCache[slot].name != NULL
+               && strcmp(commandCache[slot].name, name) != 0)
+                slot = (slot + 1) & mask;
+        return &commandCache[slot];
+}
+
+void forgetCommand(char *name)//drops one entry, the table is rebuilt around the hole
+{
+        t_hashedCommand *entry = findHashedCommand(name);
+        if (entry->name == NULL)
+                return;
+        free(entry->name);
+        free(entry->path);
+        entry->name = NULL;
+        commandCacheCount--;
+        /*Re-insert the rest of the probe run so no lookup stops early*/
+        unsigned int mask = commandCacheCapacity - 1;
+        unsigned int slot = (entry - commandCache + 1) & mask;
+        while (commandCache[slot].name != NULL) {
+                t_hashedCommand moved = commandCache[slot];
+                commandCache[slot].name = NULL;
+                *findHashedCommand(moved.name) = moved;
+                slot = (slot + 1) & mask;
+        }
+}
+
+void clearCommandCache()//hash -r, or PATH changed
+{
+        for (int i = 0; i < commandCacheCapacity; i++) {
+                if (commandCache[i].name != NULL) {
+                        free(commandCache[i].name);
+                        free(commandCache[i].path);
+                        commandCache[i].name = NULL;
+                }
+        }
+        commandCacheCount = 0;
+}
+
+void printCommandCache()//hash with no arguments
+{
+        if (commandCacheCount == 0) {
+                printf("hash: hash table empty\n");
+                return;
+        }
+        printf("hits\tcommand\n");
+        for (int i = 0; i < commandCacheCapacity; i++)
+                if (commandCache[i].name != NULL)
+                        printf("%4u\t%s\n", commandCache[i].hits, commandCache[i].path);
+}
+
+int isBuiltInCommand(char *name)
+{
+        for (int i = 0; builtInCommands[i] != NULL; i++)
+                if (strcmp(builtInCommands[i], name) == 0)
+                        return TRUE;
+        return FALSE;
+}
+
+int needsForkedShell(t_command* command)//whether a stage cannot be spawned
+{
+        return command->argc == 0 || isBuiltInCommand(command->argv[0]);
 }
 
 
-//insert a job in a global array of jobList
+//insert a job in the global job table
 t_job* insertJob(pid_t pid, pid_t pgid, char* name, char* descriptor,
                  int status)
 {
-        usleep(10000);
         t_job *newJob = malloc(sizeof(t_job));
 
-        newJob->name = (char*) malloc(sizeof(name));
-        newJob->name = strcpy(newJob->name, name);
+        newJob->name = strdup(name);
         newJob->pid = pid;
         newJob->pgid = pgid;
         newJob->status = status;
-        newJob->descriptor = (char*) malloc(sizeof(descriptor));
-        newJob->descriptor = strcpy(newJob->descriptor, descriptor);
-        newJob->next = NULL;
-
-        if (jobsList == NULL) {
-                numActiveJobs++;
-                newJob->id = numActiveJobs;
-                return newJob;
-        } else {
-                t_job *auxNode = jobsList;
-                while (auxNode->next != NULL) {
-                        auxNode = auxNode->next;
+        newJob->descriptor = strdup(descriptor);
+        newJob->processes = malloc(sizeof(pid_t));
+        newJob->processes[0] = pid;
+        newJob->numProcesses = 1;
+        newJob->runningProcesses = 1;
+        newJob->termination = 0;
+        newJob->taskIndex = -1;
+        newJob->hasTerminalModes = FALSE;
+        newJob->stopSignal = 0;
+        newJob->cgroup = NULL;
+        newJob->placement = NULL;
+        clock_gettime(CLOCK_MONOTONIC, &newJob->started);
+        memset(&newJob->usage, 0, sizeof(struct rusage));
+        jobTableGeneration++;
+
+        while (freeJobSlot < lastJobId && jobSlots[freeJobSlot] != NULL)
+                freeJobSlot++;
+        if (freeJobSlot == lastJobId) {//no hole, the table grows by one
+                if (lastJobId == jobSlotsCapacity) {
+                        jobSlotsCapacity = jobSlotsCapacity ? 2 * jobSlotsCapacity : 16;
+                        jobSlots = realloc(jobSlots, jobSlotsCapacity * sizeof(t_job*));
                 }
-                newJob->id = auxNode->id + 1;
-                auxNode->next = newJob;
-                numActiveJobs++;
-                return jobsList;
+                lastJobId++;
         }
+        newJob->id = freeJobSlot + 1;
+        jobSlots[freeJobSlot++] = newJob;
+        numActiveJobs++;
+
+        indexPid(pid, newJob);
+        t_job **list = statusListOf(status);
+        newJob->statusPrev = NULL;
+        newJob->statusNext = *list;
+        if (*list != NULL)
+                (*list)->statusPrev = newJob;
+        *list = newJob;
+        return newJob;
+}
+void addJobProcess(t_job* job, pid_t pid)//adds a pipeline stage to a job
+{
+        jobTableGeneration++;
+        job->processes = realloc(job->processes,
+                                 (job->numProcesses + 1) * sizeof(pid_t));
+        job->processes[job->numProcesses++] = pid;
+        job->runningProcesses++;
+        indexPid(pid, job);
 }
+
+void removeJobProcess(t_job* job, pid_t pid)//a process of the job terminated
+{
+        for (int i = 0; i < job->numProcesses; i++) {
+                if (job->processes[i] == pid) {
+                        jobTableGeneration++;
+                        job->processes[i] = 0;
+                        job->runningProcesses--;
+                        unindexPid(pid);
+                }
+        }
+}
+
 //to get pointer to requested job as per the choice
 t_job* getJob(int searchValue, int searchParameter)
 {
-        usleep(10000);
-        t_job* job = jobsList;
         switch (searchParameter) {
-        case BY_PROCESS_ID:
-                while (job != NULL) {
-                        if (job->pid == searchValue)
-                                return job;
-                        else
-                                job = job->next;
+        case BY_PROCESS_ID: {
+                if (pidIndexCapacity == 0)
+                        return NULL;
+                unsigned int mask = pidIndexCapacity - 1;
+                unsigned int slot = ((unsigned int) searchValue * 2654435761u) & mask;
+                while (pidIndex[slot].pid != 0) {
+                        if (pidIndex[slot].pid == searchValue)
+                                return pidIndex[slot].job;
+                        slot = (slot + 1) & mask;
                 }
                 break;
+        }
         case BY_JOB_ID:
-                while (job != NULL) {
-                        if (job->id == searchValue)
-                                return job;
-                        else
-                                job = job->next;
-                }
+                if (searchValue >= 1 && searchValue <= lastJobId)
+                        return jobSlots[searchValue - 1];
                 break;
-        case BY_JOB_STATUS:
-                while (job != NULL) {
-                        if (job->status == searchValue)
-                                return job;
-                        else
-                                job = job->next;
-                }
+        case BY_JOB_STATUS: {
+                t_job **list = statusListOf(searchValue);
+                if (list != NULL)
+                        return *list;
                 break;
+        }
         default:
                 return NULL;
                 break;
@@ -355,71 +1049,433 @@ t_job* getJob(int searchValue, int searchParameter)
         return NULL;
 }
 
+t_job** statusListOf(int status)//list head for the jobs in a given status
+{
+        switch (status) {
+        case FOREGROUND:
+                return &statusLists[0];
+        case BACKGROUND:
+                return &statusLists[1];
+        case SUSPENDED:
+                return &statusLists[2];
+        case WAITING_INPUT:
+                return &statusLists[3];
+        }
+        return NULL;
+}
+
+void indexPid(pid_t pid, t_job* job)//add pid -> job to the hash index
+{
+        /*Grow at 50% load so probe sequences stay short*/
+        if (2 * (pidIndexCount + 1) > pidIndexCapacity) {
+                t_pidEntry *oldIndex = pidIndex;
+                int oldCapacity = pidIndexCapacity;
+                pidIndexCapacity = oldCapacity ? 2 * oldCapacity : 64;
+                pidIndex = calloc(pidIndexCapacity, sizeof(t_pidEntry));
+                pidIndexCount = 0;
+                for (int i = 0; i < oldCapacity; i++)
+                        if (oldIndex[i].pid != 0)
+                                indexPid(oldIndex[i].pid, oldIndex[i].job);
+                free(oldIndex);
+        }
+        unsigned int mask = pidIndexCapacity - 1;
+        unsigned int slot = ((unsigned int) pid * 2654435761u) & mask;
+        while (pidIndex[slot].pid != 0 && pidIndex[slot].pid != pid)
+                slot = (slot + 1) & mask;
+        if (pidIndex[slot].pid == 0)
+                pidIndexCount++;
+        pidIndex[slot].pid = pid;
+        pidIndex[slot].job = job;
+}
+
+void unindexPid(pid_t pid)//remove pid from the hash index
+{
+        if (pidIndexCapacity == 0)
+                return;
+        unsigned int mask = pidIndexCapacity - 1;
+        unsigned int slot = ((unsigned int) pid * 2654435761u) & mask;
+        while (pidIndex[slot].pid != pid) {
+                if (pidIndex[slot].pid == 0)
+                        return;
+                slot = (slot + 1) & mask;
+        }
+        /*Backward-shift deletion: pull later entries of the probe sequence
+        into the hole so lookups never need tombstones*/
+        unsigned int hole = slot;
+        while (TRUE) {
+                slot = (slot + 1) & mask;
+                if (pidIndex[slot].pid == 0)
+                        break;
+                unsigned int home = ((unsigned int) pidIndex[slot].pid * 2654435761u) & mask;
+                if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+                        pidIndex[hole] = pidIndex[slot];
+                        hole = slot;
+                }
+        }
+        pidIndex[hole].pid = 0;
+        pidIndex[hole].job = NULL;
+        pidIndexCount--;
+}
+
 
 void putJobForeground(t_job* job, int continueJob)
 {
-        job->status = FOREGROUND;
-        tcsetpgrp(MSH_TERMINAL, job->pgid);
+        int jobId = job->id;
+        setJobStatus(job, FOREGROUND);
+        recordJobEvent(EVENT_FOREGROUND, job, job->pgid, 0);
+        if (MSH_IS_INTERACTIVE) {
+                tcsetpgrp(MSH_TERMINAL, job->pgid);
+                if (continueJob && job->hasTerminalModes)//say an editor stopped with ^Z
+                        tcsetattr(MSH_TERMINAL, TCSADRAIN, &job->terminalModes);
+        }
         if (continueJob) {
-                if (kill(-job->pgid, SIGCONT) < 0)
+                job->stopSignal = 0;
+                if (signalJob(job, SIGCONT) < 0)
 				//If pid is less than -1, 
 				//then sig is sent to every process in the process group whose ID is -pid. []"
                         perror("kill (SIGCONT)");
         }
 
         waitJob(job);
-        tcsetpgrp(MSH_TERMINAL, MSH_PGID);
+        if (MSH_IS_INTERACTIVE) {
+                tcsetpgrp(MSH_TERMINAL, MSH_PGID);
+                /*Keep the modes of a job that was stopped for when it is
+                continued, and give the shell back its own whatever the job
+                did, even if it crashed in raw mode*/
+                if ((job = getJob(jobId, BY_JOB_ID)) != NULL) {
+                        tcgetattr(MSH_TERMINAL, &job->terminalModes);
+                        job->hasTerminalModes = TRUE;
+                }
+                tcsetattr(MSH_TERMINAL, TCSADRAIN, &MSH_TMODES);
+        }
 }
 
 void waitJob(t_job* job)
 {
-        int terminationStatus;
-        
-		/*The waitpid() function shall not suspend execution of the calling thread 
-		if status is not immediately available for one of the child processes 
-		specified by pid*/
-		while (waitpid(job->pid, &terminationStatus, WNOHANG) == 0) {
-                if (job->status == SUSPENDED)
+        int jobId = job->id;
+        struct pollfd childEvents = { MSH_CHILD_FD, POLLIN, 0 };
+
+        /*Sleep in poll() until a SIGCHLD is pending on the signalfd, then let
+        handleChildEvents() reap it. The job is looked up again after every
+        round because it is deleted once all of its processes are gone*/
+        while ((job = getJob(jobId, BY_JOB_ID)) != NULL
+               && job->status == FOREGROUND) {
+                if (poll(&childEvents, 1, -1) == -1 && errno != EINTR) {
+                        perror("MSH");
                         return;
+                }
+                handleChildEvents();
         }
-        jobsList = delJob(job);
 }
 
-void killJob(int jobId)
+void killJobs()
+/*kill [-SIG | -s SIG] target..., kill -l. A target is a job (%n), a range of
+jobs (%n-%m), a pid, or after -- a process group (-pgid). A job is signalled
+as a whole, through its process group; handleChildEvents() drops it from
+the table once it is gone*/
 {
-        printf("The job ID %d", jobId);
-        t_job *job = getJob(jobId, BY_JOB_ID);
-        kill(job->pid, SIGKILL);
-        jobsList = jobsList->next;
+        int signalNumber = SIGTERM;
+        int i = 1;
+
+        if (commandArgv[1] != NULL && strcmp(commandArgv[1], "-l") == 0) {
+                for (int number = 1; number < NSIG; number++)
+                        if (sigabbrev_np(number) != NULL)
+                                printf("%2d) SIG%s\n", number, sigabbrev_np(number));
+                return;
+        }
+        if (commandArgv[i] != NULL && strcmp(commandArgv[i], "-s") == 0) {
+                signalNumber = commandArgv[i + 1] ? parseSignal(commandArgv[i + 1]) : -1;
+                i += commandArgv[i + 1] ? 2 : 1;
+        } else if (commandArgv[i] != NULL && commandArgv[i][0] == '-'
+                   && strcmp(commandArgv[i], "--") != 0) {
+                signalNumber = parseSignal(commandArgv[i++] + 1);
+        }
+        if (commandArgv[i] != NULL && strcmp(commandArgv[i], "--") == 0)
+                i++;
+        if (signalNumber == -1 || commandArgv[i] == NULL) {
+                if (signalNumber == -1)
+                        fprintf(stderr, "kill: %s: invalid signal\n", commandArgv[i - 1]);
+                fprintf(stderr, "usage: kill [-SIG | -s SIG] %%job | %%first-%%last | pid "
+                        "| -- -pgid...\n");
+                lastExitStatus = 2;
+                return;
+        }
+        for (; commandArgv[i] != NULL; i++) {
+                char *end;
+                char *target = commandArgv[i];
+                if (target[0] != '%') {//a pid, or a process group if negative
+                        long pid = strtol(target, &end, 10);
+                        if (*target == '\0' || *end != '\0' || pid == 0) {
+                                fprintf(stderr, "kill: %s: not a pid or %%job\n", target);
+                                lastExitStatus = 1;
+                        } else if (kill((pid_t) pid, signalNumber) == -1) {
+                                fprintf(stderr, "kill: %s: %s\n", target, strerror(errno));
+                                lastExitStatus = 1;
+                        }
+                        continue;
+                }
+                long first = strtol(target + 1, &end, 10), last = first;
+                if (*end == '-')//%n-%m, or %n-m
+                        last = strtol(end + 1 + (end[1] == '%'), &end, 10);
+                if (end == target + 1 || *end != '\0' || first < 1 || last < first) {
+                        fprintf(stderr, "kill: %s: not a job or range of jobs\n", target);
+                        lastExitStatus = 1;
+                        continue;
+                }
+                int numSignalled = 0;
+                for (long id = first; id <= last && id <= lastJobId; id++) {
+                        t_job *job = jobSlots[id - 1];
+                        if (job == NULL)
+                                continue;
+                        if (signalJob(job, signalNumber) == -1)
+                                fprintf(stderr, "kill: %%%ld: %s\n", id, strerror(errno));
+                        /*a stopped job would only see SIGTERM or SIGHUP once continued*/
+                        if ((signalNumber == SIGTERM || signalNumber == SIGHUP)
+                            && (job->status == SUSPENDED || job->status == WAITING_INPUT))
+                                signalJob(job, SIGCONT);
+                        numSignalled++;
+                }
+                if (numSignalled == 0) {
+                        fprintf(stderr, "kill: %s: no such job\n", target);
+                        lastExitStatus = 1;
+                }
+        }
 }
 
-t_job* delJob(t_job* job)
+int parseSignal(const char *name)//9, KILL or SIGKILL; -1 if there is no such signal
 {
-        usleep(10000);
-        if (jobsList == NULL)
-                return NULL;
-        t_job* currentJob;
-        t_job* beforeCurrentJob;
-
-        currentJob = jobsList->next;
-        beforeCurrentJob = jobsList;
+        char *end;
+        long number = strtol(name, &end, 10);
+        if (*name != '\0' && *end == '\0')
+                return number > 0 && number < NSIG ? (int) number : -1;
+        if (strncasecmp(name, "SIG", 3) == 0)
+                name += 3;
+        for (int i = 1; i < NSIG; i++)
+                if (sigabbrev_np(i) != NULL && strcasecmp(sigabbrev_np(i), name) == 0)
+                        return i;
+        return -1;
+}
 
-        if (beforeCurrentJob->pid == job->pid) {
+void waitJobs()
+/*wait [-n] [%n | pid...]: until the jobs named, or all of them, are done
+or stopped; with -n until any one is. The shell sleeps in epoll_wait() on
+one pidfd per job, which becomes readable when that process exits, so a
+script can wait on hundreds of jobs at once; the SIGCHLD signalfd is in the
+set too, for the jobs that stop. SIGINT, read from a signalfd meanwhile,
+interrupts the wait*/
+{
+        int any = FALSE, i = 1, lastOperand = 0, numWaited = 0;
+        int operandStatus = -1;//of the last operand that had finished already
+        int poller, interrupt;
+        sigset_t interruptMask;
+        struct epoll_event events[64];
+        struct signalfd_siginfo info;
 
-                beforeCurrentJob = beforeCurrentJob->next;
-                numActiveJobs--;
-                return currentJob;
+        if (commandArgv[i] != NULL && strcmp(commandArgv[i], "-n") == 0) {
+                any = TRUE;
+                i++;
+        }
+        handleChildEvents();//what finished meanwhile is gone already
+        numWaitSlots = lastJobId;
+        waitSlots = calloc(numWaitSlots + 1, sizeof(t_waitSlot));
+        for (int id = 1; id <= numWaitSlots; id++)
+                waitSlots[id - 1].descriptor = -1;
+        numWaitsFinished = 0;
+        firstWaitFinished = 0;
+        if (commandArgv[i] == NULL && any && numFinishedJobs > 0) {
+                operandStatus = finishedJobs[0].status;//the one that finished first
+                memmove(finishedJobs, finishedJobs + 1, --numFinishedJobs * sizeof(t_finishedJob));
+        } else if (commandArgv[i] == NULL) {
+                numFinishedJobs = 0;//none of them is wanted any more
+                for (int id = 1; id <= lastJobId; id++) {
+                        if (jobSlots[id - 1] != NULL) {
+                                waitSlots[id - 1].waited = TRUE;
+                                numWaited++;
+                        }
+                }
         }
+        for (; commandArgv[i] != NULL; i++) {
+                char *target = commandArgv[i];
+                t_job *job = target[0] == '%' ? getJob(atoi(target + 1), BY_JOB_ID) :
+                             getJob(atoi(target), BY_PROCESS_ID);
+                lastOperand = job ? job->id : 0;
+                if (job == NULL && (operandStatus = takeFinishedJob(target)) == -1) {
+                        fprintf(stderr, "wait: %s: no such job\n", target);
+                        lastExitStatus = 127;
+                } else if (job != NULL && !waitSlots[job->id - 1].waited) {
+                        waitSlots[job->id - 1].waited = TRUE;
+                        numWaited++;
+                }
+        }
+        for (int id = 1; id <= numWaitSlots; id++)//stopped before wait began
+                if (waitSlots[id - 1].waited && jobSlots[id - 1]->stopSignal != 0)
+                        finishWait(jobSlots[id - 1], 128 + jobSlots[id - 1]->stopSignal);
+
+        poller = epoll_create1(EPOLL_CLOEXEC);
+        sigemptyset(&interruptMask);
+        sigaddset(&interruptMask, SIGINT);
+        sigprocmask(SIG_BLOCK, &interruptMask, NULL);
+        interrupt = signalfd(-1, &interruptMask, SFD_NONBLOCK | SFD_CLOEXEC);
+        struct epoll_event event = { .events = EPOLLIN, .data.u64 = 0 };
+        epoll_ctl(poller, EPOLL_CTL_ADD, interrupt, &event);
+        event.data.u64 = (uint64_t) -1;//also all there is without pidfds
+        epoll_ctl(poller, EPOLL_CTL_ADD, MSH_CHILD_FD, &event);
+        for (int id = 1; id <= numWaitSlots; id++)
+                if (waitSlots[id - 1].waited && !waitSlots[id - 1].finished)
+                        watchJob(poller, jobSlots[id - 1]);
 
-        while (currentJob != NULL) {
-                if (currentJob->pid == job->pid) {
-                        numActiveJobs--;
-                        beforeCurrentJob->next = currentJob->next;
+        int interrupted = FALSE;
+        while (numWaited > 0 && !interrupted && !(any && operandStatus != -1)
+               && (any ? numWaitsFinished == 0 : numWaitsFinished < numWaited)) {
+                int numEvents = epoll_wait(poller, events, 64, -1);
+                if (numEvents == -1 && errno != EINTR)
+                        break;
+                handleChildEvents();
+                for (int j = 0; j < numEvents; j++) {
+                        uint64_t data = events[j].data.u64;
+                        if (data == 0) {
+                                interrupted = TRUE;
+                        } else if (data != (uint64_t) -1) {//the pidfd of job data
+                                t_waitSlot *slot = &waitSlots[data - 1];
+                                close(slot->descriptor);
+                                slot->descriptor = -1;
+                                if (!slot->finished)//another stage still runs
+                                        watchJob(poller, jobSlots[data - 1]);
+                        }
                 }
-                beforeCurrentJob = currentJob;
-                currentJob = currentJob->next;
         }
-        return jobsList;
+
+        for (int id = 1; id <= numWaitSlots; id++)//of jobs still running
+                if (waitSlots[id - 1].descriptor != -1)
+                        close(waitSlots[id - 1].descriptor);
+        /*Taken off the signalfd, or unblocking it below delivers it, and
+        without a terminal nothing ignores SIGINT: it would end a script*/
+        while (read(interrupt, &info, sizeof(info)) == sizeof(info))
+                interrupted = TRUE;
+        close(interrupt);
+        close(poller);
+        sigprocmask(SIG_UNBLOCK, &interruptMask, NULL);
+        if (interrupted) {
+                if (MSH_IS_INTERACTIVE)
+                        printf("\n");//after the ^C
+                lastExitStatus = 130;
+        } else if (any && firstWaitFinished > 0)
+                lastExitStatus = waitSlots[firstWaitFinished - 1].status;
+        else if (any && operandStatus != -1)
+                lastExitStatus = operandStatus;
+        else if (lastOperand > 0)
+                lastExitStatus = waitSlots[lastOperand - 1].status;
+        else if (operandStatus != -1)
+                lastExitStatus = operandStatus;
+        free(waitSlots);
+        waitSlots = NULL;
+        numWaitSlots = 0;
+}
+
+void finishWait(t_job* job, int status)
+/*job exited or stopped with status; the wait builtin stops waiting for it
+if it was*/
+{
+        t_waitSlot *slot = job->id <= numWaitSlots ? &waitSlots[job->id - 1] : NULL;
+        if (slot == NULL || !slot->waited || slot->finished)
+                return;
+        slot->finished = TRUE;
+        slot->status = status;
+        if (numWaitsFinished++ == 0)
+                firstWaitFinished = job->id;
+}
+
+void keepFinishedJob(t_job* job)//for a later wait, see finishedJobs
+{
+        if (numFinishedJobs == FINISHED_JOBS_KEPT) {//the older half goes
+                numFinishedJobs /= 2;
+                memmove(finishedJobs, finishedJobs + FINISHED_JOBS_KEPT - numFinishedJobs,
+                        numFinishedJobs * sizeof(t_finishedJob));
+        }
+        finishedJobs[numFinishedJobs].id = job->id;
+        finishedJobs[numFinishedJobs].pid = job->pid;
+        finishedJobs[numFinishedJobs].status = jobExitStatus(job->termination);
+        numFinishedJobs++;
+}
+
+int takeFinishedJob(const char *target)
+/*the status of the finished job %n or pid, which wait then has used; -1 if
+there is none. Job ids are used again, so the latest one counts*/
+{
+        int byId = target[0] == '%';
+        int number = atoi(target + byId);
+        for (int i = numFinishedJobs - 1; i >= 0; i--) {
+                if ((byId ? finishedJobs[i].id : finishedJobs[i].pid) != number)
+                        continue;
+                int status = finishedJobs[i].status;
+                memmove(finishedJobs + i, finishedJobs + i + 1,
+                        (--numFinishedJobs - i) * sizeof(t_finishedJob));
+                return status;
+        }
+        return -1;
+}
+
+int watchJob(int poller, t_job* job)
+/*adds a pidfd of the last live process of job to poller, FALSE if there is
+none that can be opened*/
+{
+        for (int i = job->numProcesses - 1; i >= 0; i--) {
+                if (job->processes[i] == 0)
+                        continue;
+                int descriptor = (int) syscall(SYS_pidfd_open, job->processes[i], 0);
+                if (descriptor == -1)//pidfds are close-on-exec already
+                        return FALSE;
+                struct epoll_event event = { .events = EPOLLIN, .data.u64 = job->id };
+                epoll_ctl(poller, EPOLL_CTL_ADD, descriptor, &event);
+                waitSlots[job->id - 1].descriptor = descriptor;
+                return TRUE;
+        }
+        return FALSE;
+}
+
+int jobExitStatus(int termination)//a job's wait status, the way $? shows it
+{
+        return WIFSIGNALED(termination) ? 128 + WTERMSIG(termination) : WEXITSTATUS(termination);
+}
+
+int signalJob(t_job* job, int signalNumber)//sends a signal to every process of a job
+{
+        if (MSH_IS_INTERACTIVE)
+                return kill(-job->pgid, signalNumber);
+        /*Without job control the job has no process group of its own*/
+        int result = 0;
+        for (int i = 0; i < job->numProcesses; i++)
+                if (job->processes[i] != 0 && kill(job->processes[i], signalNumber) < 0)
+                        result = -1;
+        return result;
+}
+
+void delJob(t_job* job)
+{
+        t_job **list = statusListOf(job->status);
+        if (job->statusPrev != NULL)
+                job->statusPrev->statusNext = job->statusNext;
+        else
+                *list = job->statusNext;
+        if (job->statusNext != NULL)
+                job->statusNext->statusPrev = job->statusPrev;
+        for (int i = 0; i < job->numProcesses; i++)
+                if (job->processes[i] != 0)
+                        unindexPid(job->processes[i]);
+
+        jobTableGeneration++;
+        jobSlots[job->id - 1] = NULL;
+        if (job->id - 1 < freeJobSlot)
+                freeJobSlot = job->id - 1;
+        while (lastJobId > 0 && jobSlots[lastJobId - 1] == NULL)
+                lastJobId--;
+        numActiveJobs--;
+        removeJobCgroup(job);
+        free(job->placement);
+        free(job->name);
+        free(job->descriptor);
+        free(job->processes);
+        free(job);
 }
 
 
@@ -428,39 +1484,58 @@ void putJobBackground(t_job* job, int continueJob)
         if (job == NULL)
                 return;
 
+        recordJobEvent(EVENT_BACKGROUND, job, job->pgid, 0);
         if (continueJob && job->status != WAITING_INPUT)
-                job->status = WAITING_INPUT;
-        if (continueJob)
-                if (kill(-job->pgid, SIGCONT) < 0)
+                setJobStatus(job, WAITING_INPUT);
+        if (continueJob) {
+                job->stopSignal = 0;
+                if (signalJob(job, SIGCONT) < 0)
                         perror("kill (SIGCONT)");
+        }
 
-        tcsetpgrp(MSH_TERMINAL, MSH_PGID);
+        if (MSH_IS_INTERACTIVE)
+                tcsetpgrp(MSH_TERMINAL, MSH_PGID);
 }
 
 
 int changeJobStatus(int pid, int status)//to change status attribute of a job with pid
 {
-        usleep(10000);
-        t_job *job = jobsList;
-        if (job == NULL) {
-                return 0;
-        } else {
-                int counter = 0;
-                while (job != NULL) {
-                        if (job->pid == pid) {
-                                job->status = status;
-                                return TRUE;
-                        }
-                        counter++;
-                        job = job->next;
-                }
+        t_job *job = getJob(pid, BY_PROCESS_ID);
+        if (job == NULL)
                 return FALSE;
-        }
+        setJobStatus(job, status);
+        return TRUE;
+}
+
+void setJobStatus(t_job* job, int status)//moves a job to the list of its new status
+{
+        if (job->status == status)
+                return;
+        jobTableGeneration++;
+        t_job **list = statusListOf(job->status);
+        if (job->statusPrev != NULL)
+                job->statusPrev->statusNext = job->statusNext;
+        else
+                *list = job->statusNext;
+        if (job->statusNext != NULL)
+                job->statusNext->statusPrev = job->statusPrev;
+
+        job->status = status;
+        list = statusListOf(status);
+        job->statusPrev = NULL;
+        job->statusNext = *list;
+        if (*list != NULL)
+                (*list)->statusPrev = job;
+        *list = job;
 }
 
 
-void printJobs()//prints the global jobList array
+void printJobs(int longFormat)//prints the global job table, jobs -l adds resource usage
 {
+        if (longFormat) {
+                printJobsUsage();
+                return;
+        }
         printf("\nActive jobs:\n");
         printf(
                 "---------------------------------------------------------------------------\n");
@@ -468,18 +1543,330 @@ void printJobs()//prints the global jobList array
                "descriptor", "status");
         printf(
                 "---------------------------------------------------------------------------\n");
-        t_job* job = jobsList;
-        if (job == NULL) {
+        if (numActiveJobs == 0) {
                 printf("| %s %62s |\n", "No Jobs.", "");
         } else {
-                while (job != NULL) {
-                        printf("|  %7d | %30s | %5d | %10s | %6c |\n", job->id, job->name,
+                for (int id = 1; id <= lastJobId; id++) {
+                        t_job* job = jobSlots[id - 1];
+                        if (job == NULL)
+                                continue;
+                        printf("|  %7d | %30.30s | %5d | %10s | %6c |\n", job->id, job->name,
                                job->pid, job->descriptor, job->status);
-                        job = job->next;
+                        if (job->placement != NULL)
+                                printJobPlacement(job);
+                        if (job->cgroup != NULL)
+                                printJobPressure(job);
                 }
         }
         printf(
                 "---------------------------------------------------------------------------\n");
 }
 
+void printJobsListing(int format)
+/*jobs --json and jobs --tsv, for scripts that poll the job table. Jobs only
+change in handleChildEvents() and the builtins, never while this runs, so one
+pass over the table is a consistent snapshot; while the generation is the
+same, the previous text is written again without walking the table*/
+{
+        if (format != jobsListingFormat || jobsListingGeneration != jobTableGeneration) {
+                char field[128];
+                jobsListingLength = 0;
+                if (format == JOBS_JSON) {
+                        snprintf(field, sizeof(field), "{\"generation\": %lu, \"jobs\": [",
+                                 jobTableGeneration);
+                        appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                                    field, strlen(field));
+                } else {
+                        snprintf(field, sizeof(field), "# generation %lu\n"
+                                 "id\tpgid\tstatus\tdescriptor\tprocesses\tname\n",
+                                 jobTableGeneration);
+                        appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                                    field, strlen(field));
+                }
+                int numListed = 0;
+                for (int id = 1; id <= lastJobId; id++) {
+                        t_job* job = jobSlots[id - 1];
+                        if (job != NULL)
+                                formatJob(job, format, numListed++ > 0);
+                }
+                if (format == JOBS_JSON)
+                        appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                                    "]}\n", 3);
+                jobsListingFormat = format;
+                jobsListingGeneration = jobTableGeneration;
+        }
+        fflush(stdout);
+        for (size_t done = 0; done < jobsListingLength; ) {
+                ssize_t written = write(STDOUT_FILENO, jobsListing + done,
+                                        jobsListingLength - done);
+                if (written <= 0)
+                        break;
+                done += written;
+        }
+}
 
+void formatJob(t_job* job, int format, int notFirst)//one job of printJobsListing()
+{
+        static const char *statusNames[] = { "foreground", "background", "suspended",
+                                             "waiting_input" };
+        const char *status = statusNames[job->status == FOREGROUND ? 0 :
+                                         job->status == BACKGROUND ? 1 :
+                                         job->status == SUSPENDED ? 2 : 3];
+        char field[128];
+
+        if (format == JOBS_JSON) {
+                snprintf(field, sizeof(field), "%s{\"id\": %d, \"pgid\": %d, \"status\": \"%s\", "
+                         "\"descriptor\": ", notFirst ? ", " : "", job->id, (int) job->pgid, status);
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                            field, strlen(field));
+                appendJsonString(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                                 job->descriptor);
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                            ", \"processes\": [", 16);
+        } else {
+                snprintf(field, sizeof(field), "%d\t%d\t%s\t%s\t", job->id, (int) job->pgid,
+                         status, job->descriptor);
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                            field, strlen(field));
+        }
+        int numRunning = 0;
+        for (int i = 0; i < job->numProcesses; i++) {//the ones not reaped yet
+                if (job->processes[i] == 0)
+                        continue;
+                snprintf(field, sizeof(field), "%s%d", numRunning++ > 0 ?
+                         (format == JOBS_JSON ? ", " : ",") : "", (int) job->processes[i]);
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                            field, strlen(field));
+        }
+        if (format == JOBS_JSON) {
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                            "], \"name\": ", 11);
+                appendJsonString(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                                 job->name);
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity, "}", 1);
+        } else {
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity, "\t", 1);
+                for (char *c = job->name; *c != '\0'; c++)//a row stays on one line
+                        appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity,
+                                    *c == '\t' || *c == '\n' ? " " : c, 1);
+                appendBytes(&jobsListing, &jobsListingLength, &jobsListingCapacity, "\n", 1);
+        }
+}
+
+int runParallel(char *command[])
+/*parallel [-j N] command [arguments] ::: values...
+runs command once for every value, appended as its last argument, keeping
+at most N tasks (default: one per CPU) running at any time. Tasks are
+ordinary jobs in the job table; the shell sleeps on the SIGCHLD signalfd
+and starts the next task as soon as one is reaped, so there is no scan of
+the job table however many tasks there are*/
+{
+        int maxRunning = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        int first = 0;
+        if (command[0] != NULL && strncmp(command[0], "-j", 2) == 0) {
+                char *value = command[0][2] ? command[0] + 2 : command[1];
+                maxRunning = value ? atoi(value) : 0;
+                first = command[0][2] ? 1 : 2;
+                if (value == NULL)
+                        first = 1;
+        }
+        int separator = first;
+        while (command[separator] != NULL && strcmp(command[separator], ":::") != 0)
+                separator++;
+        if (maxRunning < 1 || separator == first || command[separator] == NULL) {
+                printf("usage: parallel [-j N] command [arguments] ::: values...\n");
+                lastExitStatus = 2;
+                return -1;
+        }
+        if (isBuiltInCommand(command[first])) {//tasks are spawned, not forked shells
+                fprintf(stderr, "parallel: %s: a builtin cannot be run as a task\n",
+                        command[first]);
+                lastExitStatus = 2;
+                return -1;
+        }
+        int templateLength = separator - first;
+        char **values = command + separator + 1;
+        int numTasks = 0;
+        while (values[numTasks] != NULL)
+                numTasks++;
+
+        char **taskArgv = malloc((templateLength + 2) * sizeof(char*));
+        memcpy(taskArgv, command + first, templateLength * sizeof(char*));
+        taskArgv[templateLength + 1] = NULL;
+        t_command task = { .argv = taskArgv, .argc = templateLength + 1 };
+        parallelRunning = 0;
+        parallelFailed = 0;
+        MSH_INTERRUPTED = FALSE;
+
+        /*SIGINT is read from the signalfd for the duration, so Ctrl-C stops
+        the whole run even though the tasks are not in the foreground*/
+        sigset_t signals = MSH_CHILD_MASK;
+        sigaddset(&signals, SIGINT);
+        sigprocmask(SIG_BLOCK, &signals, NULL);
+        signalfd(MSH_CHILD_FD, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+        struct timespec started;
+        struct pollfd childEvents = { MSH_CHILD_FD, POLLIN, 0 };
+        int next = 0;
+        int stopping = FALSE;//the running tasks were sent SIGTERM
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        printf("%6s  %4s  %10s  %s\n", "task", "exit", "wall", "command");
+        while (TRUE) {
+                while (!MSH_INTERRUPTED && next < numTasks
+                       && parallelRunning < maxRunning) {
+                        taskArgv[templateLength] = values[next];
+                        fflush(stdout);
+                        struct timespec launched;
+                        clock_gettime(CLOCK_MONOTONIC, &launched);
+                        pid_t pid = spawnProcess(&task, BACKGROUND, 0, -1, -1);
+                        if (pid == -1) {
+                                parallelFailed++;
+                                next++;
+                                continue;
+                        }
+                        char *name = joinArguments(taskArgv);
+                        t_job *job = insertJob(pid, pid, name, "STANDARD", BACKGROUND);
+                        free(name);
+                        job->taskIndex = next++;
+                        parallelRunning++;
+                        recordJobEvent(EVENT_LAUNCH, job, pid,
+                                       (long) (secondsSince(&launched) * 1e9));
+                }
+                if (parallelRunning == 0)
+                        break;
+                if (poll(&childEvents, 1, -1) == -1 && errno != EINTR)
+                        break;
+                handleChildEvents();
+                if (MSH_INTERRUPTED && !stopping) {//stop the running tasks, launch no more
+                        for (t_job *job = getJob(BACKGROUND, BY_JOB_STATUS); job != NULL;
+                             job = job->statusNext)
+                                if (job->taskIndex >= 0)
+                                        signalJob(job, SIGTERM);
+                        stopping = TRUE;
+                }
+        }
+        signalfd(MSH_CHILD_FD, &MSH_CHILD_MASK, SFD_NONBLOCK | SFD_CLOEXEC);
+        sigdelset(&signals, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &signals, NULL);
+
+        printf("parallel: %d of %d tasks run, %d failed, %.3fs\n", next, numTasks,
+               parallelFailed, secondsSince(&started));
+        free(taskArgv);
+        lastExitStatus = parallelFailed > 101 ? 101 : parallelFailed;
+        if (next < numTasks && lastExitStatus == 0)
+                lastExitStatus = 130;
+        return lastExitStatus;
+}
+
+void finishParallelTask(t_job* job)//called by handleChildEvents() for every task
+{
+        int exitCode = jobExitStatus(job->termination);
+        printf("%6d  %4d  %9.3fs  %s\n", job->taskIndex + 1, exitCode,
+               secondsSince(&job->started), job->name);
+        if (exitCode != 0)
+                parallelFailed++;
+        parallelRunning--;
+}
+
+char* joinArguments(char *command[])//the words of a command as one string
+{
+        size_t length = 1;
+        for (int i = 0; command[i] != NULL; i++)
+                length += strlen(command[i]) + 1;
+        char *text = malloc(length);
+        char *end = text;
+        *end = '\0';
+        for (int i = 0; command[i] != NULL; i++)
+                end += sprintf(end, i ? " %s" : "%s", command[i]);
+        return text;
+}
+
+double secondsSince(struct timespec *start)//wall time on CLOCK_MONOTONIC
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void addUsage(struct rusage *total, struct rusage *usage)//sums up a job's processes
+{
+        timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+        timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+        if (usage->ru_maxrss > total->ru_maxrss)//the largest stage, not a sum
+                total->ru_maxrss = usage->ru_maxrss;
+        total->ru_nvcsw += usage->ru_nvcsw;
+        total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+void sampleProcessUsage(pid_t pid, struct rusage *usage)
+/*the usage so far of a process that is still running, from /proc, since
+wait4() only reports it once the process is reaped*/
+{
+        char path[64], line[256];
+        unsigned long userTicks, systemTicks;
+        long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+        memset(usage, 0, sizeof(struct rusage));
+        sprintf(path, "/proc/%d/stat", (int) pid);
+        FILE *stat = fopen(path, "r");
+        if (stat == NULL)
+                return;
+        /*utime and stime are fields 14 and 15; the command name (field 2)
+        may contain spaces, so start after its closing parenthesis*/
+        if (fgets(line, sizeof(line), stat) != NULL && strrchr(line, ')') != NULL
+            && sscanf(strrchr(line, ')') + 2,
+                      "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                      &userTicks, &systemTicks) == 2) {
+                usage->ru_utime.tv_sec = userTicks / ticksPerSecond;
+                usage->ru_utime.tv_usec = userTicks % ticksPerSecond * 1000000 / ticksPerSecond;
+                usage->ru_stime.tv_sec = systemTicks / ticksPerSecond;
+                usage->ru_stime.tv_usec = systemTicks % ticksPerSecond * 1000000 / ticksPerSecond;
+        }
+        fclose(stat);
+        sprintf(path, "/proc/%d/status", (int) pid);
+        FILE *status = fopen(path, "r");
+        if (status == NULL)
+                return;
+        while (fgets(line, sizeof(line), status) != NULL) {
+                sscanf(line, "VmHWM: %ld", &usage->ru_maxrss);
+                sscanf(line, "voluntary_ctxt_switches: %ld", &usage->ru_nvcsw);
+                sscanf(line, "nonvoluntary_ctxt_switches: %ld", &usage->ru_nivcsw);
+        }
+        fclose(status);
+}
+
+void printJobsUsage()//jobs -l
+{
+        printf("\nActive jobs:\n");
+        printf(
+                "------------------------------------------------------------------------------------------\n");
+        printf("| %7s | %6s | %6s | %9s | %8s | %8s | %9s | %11s | %-s\n", "job no.",
+               "pid", "status", "wall", "user", "sys", "maxrss KB", "ctxsw v/i", "name");
+        printf(
+                "------------------------------------------------------------------------------------------\n");
+        if (numActiveJobs == 0)
+                printf("| No Jobs.\n");
+        for (int id = 1; id <= lastJobId; id++) {
+                t_job* job = jobSlots[id - 1];
+                if (job == NULL)
+                        continue;
+                /*reaped stages come from wait4(), live ones are sampled*/
+                struct rusage usage = job->usage, live;
+                for (int i = 0; i < job->numProcesses; i++) {
+                        if (job->processes[i] == 0)
+                                continue;
+                        sampleProcessUsage(job->processes[i], &live);
+                        addUsage(&usage, &live);
+                }
+                char switches[32];
+                snprintf(switches, sizeof(switches), "%ld/%ld", usage.ru_nvcsw,
+                         usage.ru_nivcsw);
+                printf("| %7d | %6d | %6c | %8.3fs | %3ld.%03lds | %3ld.%03lds | %9ld | %11s | %s\n",
+                       job->id, job->pid, job->status, secondsSince(&job->started),
+                       (long) usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec / 1000,
+                       (long) usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec / 1000,
+                       usage.ru_maxrss, switches, job->name);
+        }
+        printf(
+                "------------------------------------------------------------------------------------------\n");
+}
@@ -0,0 +1,306 @@
+/*Shell variables. The environment the shell was started with is imported
+into the table, exported, and new ones are set with NAME=value or export.
+References are left marked in the words by the lexer and expanded only when
+their pipeline is about to run, so a=1; echo $a sees the new value*/
+
+void importEnvironment(char **envp)
+{
+        for (char **entry = envp; *entry != NULL; entry++) {
+                char *equals = strchr(*entry, '=');
+                if (equals != NULL && isVariableName(*entry, equals - *entry))
+                        setVariable(*entry, equals - *entry, equals + 1, TRUE);
+        }
+}
+
+t_variable* findVariable(const char *name, size_t length)
+/*the slot holding name, or the empty slot where it would go*/
+{
+        static t_variable none;
+        if (variablesCapacity == 0)
+                return &none;
+        unsigned int hash = 5381;
+        for (size_t i = 0; i < length; i++)
+                hash = hash * 33 + (unsigned char) name[i];
+        unsigned int mask = variablesCapacity - 1;
+        unsigned int slot = hash & mask;
+        while (variables[slot].text != NULL
+               && (variables[slot].nameLength != length
+                   || memcmp(variables[slot].text, name, length) != 0))
+                slot = (slot + 1) & mask;
+        return &variables[slot];
+}
+
+char* lookupVariable(const char *name)//the value, NULL if it is not set
+{
+        t_variable *variable = findVariable(name, strlen(name));
+        return variable->text ? variable->text + variable->nameLength + 1 : NULL;
+}
+
+void setVariable(const char *name, size_t nameLength, const char *value, int exported)
+/*exported only adds the attribute; a variable stays exported once it is*/
+{
+        if (2 * (variablesCount + 1) > variablesCapacity) {
+                t_variable *oldVariables = variables;
+                int oldCapacity = variablesCapacity;
+                variablesCapacity = oldCapacity ? 2 * oldCapacity : 128;
+                variables = calloc(variablesCapacity, sizeof(t_variable));
+                for (int i = 0; i < oldCapacity; i++)
+                        if (oldVariables[i].text != NULL)
+                                *findVariable(oldVariables[i].text,
+                                              oldVariables[i].nameLength) = oldVariables[i];
+                free(oldVariables);
+        }
+        t_variable *variable = findVariable(name, nameLength);
+        char *text = malloc(nameLength + strlen(value) + 2);
+        memcpy(text, name, nameLength);
+        text[nameLength] = '=';
+        strcpy(text + nameLength + 1, value);
+        if (variable->text == NULL) {
+                variablesCount++;
+                variable->nameLength = nameLength;
+                variable->exported = FALSE;
+        }
+        free(variable->text);
+        variable->text = text;
+        variable->exported |= exported;
+        if (variable->exported)
+                environmentDirty = TRUE;
+        if (nameLength == 4 && memcmp(name, "PATH", 4) == 0)
+                clearCommandCache();//the hashed paths came from the old one
+}
+
+void unsetVariable(const char *name)//the table is rebuilt around the hole
+{
+        t_variable *variable = findVariable(name, strlen(name));
+        if (variable->text == NULL)
+                return;
+        if (variable->exported)
+                environmentDirty = TRUE;
+        if (strcmp(name, "PATH") == 0)
+                clearCommandCache();
+        free(variable->text);
+        variable->text = NULL;
+        variablesCount--;
+        /*Re-insert the rest of the probe run so no lookup stops early*/
+        unsigned int mask = variablesCapacity - 1;
+        unsigned int slot = (variable - variables + 1) & mask;
+        while (variables[slot].text != NULL) {
+                t_variable moved = variables[slot];
+                variables[slot].text = NULL;
+                *findVariable(moved.text, moved.nameLength) = moved;
+                slot = (slot + 1) & mask;
+        }
+}
+
+void assignVariables(t_command* command)
+/*NAME=value words as shell variables. Before a builtin they are set for
+good rather than for that builtin alone*/
+{
+        for (int i = 0; i < command->numAssignments; i++) {
+                char *equals = strchr(command->assignments[i], '=');
+                setVariable(command->assignments[i], equals - command->assignments[i],
+                            equals + 1, FALSE);
+        }
+}
+
+char** buildEnvironment()
+/*the environment of commands. The array only points at the variables'
+own NAME=value strings, and is built again only after an exported variable
+was set or unset, not for every command*/
+{
+        if (!environmentDirty)
+                return environment;
+        int count = 0;
+        environment = realloc(environment, (variablesCount + 1) * sizeof(char*));
+        for (int i = 0; i < variablesCapacity; i++)
+                if (variables[i].text != NULL && variables[i].exported)
+                        environment[count++] = variables[i].text;
+        environment[count] = NULL;
+        environmentDirty = FALSE;
+        return environment;
+}
+
+char** commandEnvironment(t_command* command)
+/*with NAME=value cmd, the environment of cmd alone has NAME set. That copy is
+made in the arena; every other command shares buildEnvironment()'s*/
+{
+        char **shared = buildEnvironment();
+        if (command->numAssignments == 0)
+                return shared;
+        int count = 0;
+        while (shared[count] != NULL)
+                count++;
+        char **copy = arenaAlloc((count + command->numAssignments + 1) * sizeof(char*));
+        int numCopied = 0;
+        for (int i = 0; i < count; i++) {
+                size_t nameLength = strchr(shared[i], '=') - shared[i] + 1;
+                int overridden = FALSE;
+                for (int j = 0; j < command->numAssignments && !overridden; j++)
+                        overridden = strncmp(command->assignments[j], shared[i], nameLength) == 0;
+                if (!overridden)
+                        copy[numCopied++] = shared[i];
+        }
+        for (int j = 0; j < command->numAssignments; j++)//the last of a name wins
+                copy[numCopied++] = command->assignments[j];
+        copy[numCopied] = NULL;
+        return copy;
+}
+
+void exportVariables()//export [NAME[=value]...]
+{
+        if (commandArgv[1] == NULL) {
+                buildEnvironment();
+                int count = 0;
+                while (environment[count] != NULL)
+                        count++;
+                char **sorted = malloc(count * sizeof(char*));
+                memcpy(sorted, environment, count * sizeof(char*));
+                qsort(sorted, count, sizeof(char*), compareStrings);
+                for (int i = 0; i < count; i++)
+                        printf("export %s\n", sorted[i]);
+                free(sorted);
+                return;
+        }
+        for (int i = 1; commandArgv[i] != NULL; i++) {
+                char *equals = strchr(commandArgv[i], '=');
+                size_t nameLength = equals ? (size_t) (equals - commandArgv[i])
+                                           : strlen(commandArgv[i]);
+                if (!isVariableName(commandArgv[i], nameLength)) {
+                        fprintf(stderr, "export: `%s': not a valid identifier\n", commandArgv[i]);
+                        lastExitStatus = 1;
+                        continue;
+                }
+                if (equals == NULL) {//an unset name is exported empty
+                        t_variable *variable = findVariable(commandArgv[i], nameLength);
+                        setVariable(commandArgv[i], nameLength,
+                                    variable->text ? variable->text + nameLength + 1 : "", TRUE);
+                } else {
+                        setVariable(commandArgv[i], nameLength, equals + 1, TRUE);
+                }
+        }
+}
+
+void unsetVariables()//unset NAME...
+{
+        for (int i = 1; commandArgv[i] != NULL; i++) {
+                if (!isVariableName(commandArgv[i], strlen(commandArgv[i]))) {
+                        fprintf(stderr, "unset: `%s': not a valid identifier\n", commandArgv[i]);
+                        lastExitStatus = 1;
+                        continue;
+                }
+                unsetVariable(commandArgv[i]);
+        }
+}
+
+void expandPipeline(t_pipeline* pipeline)
+/*replaces the references in the words of the pipeline's commands with the
+values the variables have now. Results go to the arena with the rest of the
+line; a command without references is left alone*/
+{
+        for (t_command *command = pipeline->commands; command != NULL;
+             command = command->next) {
+                if (!command->expands)
+                        continue;
+                for (int i = 0; i < command->numAssignments; i++)
+                        command->assignments[i] = expandWord(command->assignments[i], NULL);
+                for (t_redirection *redirection = command->redirections; redirection != NULL;
+                     redirection = redirection->next) {
+                        if (redirection->type == REDIRECT_HERE_DOCUMENT
+                            || redirection->type == REDIRECT_DUPLICATE)
+                                continue;//a body, or a number checked by the parser
+                        char *target = expandWord(redirection->target, NULL);
+                        if (redirection->target == pipeline->backgroundFile)
+                                pipeline->backgroundFile = target;
+                        redirection->target = target;
+                }
+                /*An unquoted reference may split into several words, or
+                leave none, and a pattern become many; they are gathered in
+                the parser's arguments*/
+                int argc = 0;
+                for (int i = 0; i < command->argc; i++) {
+                        if (strpbrk(command->argv[i], "\001\002\003") == NULL)//no marks
+                                addArgument(&argc, command->argv[i]);
+                        else
+                                expandWord(command->argv[i], &argc);
+                }
+                if (argc > command->argc)
+                        command->argv = arenaAlloc((argc + 1) * sizeof(char*));
+                memcpy(command->argv, arguments, argc * sizeof(char*));
+                command->argv[argc] = NULL;
+                command->argc = argc;
+        }
+}
+
+char* expandWord(char *word, int *argc)
+/*the word with its references replaced. With argc, the values of unquoted
+references are split on blanks and the resulting words are globbed into the
+parser's arguments instead; a word left empty by them is dropped, as "" is
+kept. Without, GLOB_ marks are removed: a file name is never globbed*/
+{
+        int hasWord = FALSE;//something besides split blanks was seen
+
+        wordLength = 0;
+        for (char *c = word; *c != '\0'; c++) {
+                if (*c != VARIABLE_SPLIT && *c != VARIABLE_QUOTED) {
+                        appendToWord(*c);//GLOB_ marks stay as they are
+                        hasWord = TRUE;
+                        continue;
+                }
+                char *end = strchr(c + 1, *c);
+                if (end == c + 1) {//a doubled mark stands for itself
+                        appendToWord(*c);
+                        hasWord = TRUE;
+                        c = end;
+                        continue;
+                }
+                const char *value = variableValue(c + 1, end - c - 1);
+                if (*c == VARIABLE_QUOTED || argc == NULL) {
+                        while (*value != '\0') {//copied in runs, values can be large
+                                size_t length = strcspn(value, "\003");
+                                appendRunToWord(value, length);
+                                value += length;
+                                if (*value == GLOB_MARK) {//doubled, values are not patterns
+                                        appendRunToWord("\003\003", 2);
+                                        value++;
+                                }
+                        }
+                        hasWord = TRUE;
+                } else {
+                        for (; *value != '\0'; value++) {
+                                if (*value != ' ' && *value != '\t' && *value != '\n') {
+                                        if (*value == GLOB_MARK)
+                                                appendToWord(GLOB_MARK);
+                                        appendToWord(*value);
+                                        hasWord = TRUE;
+                                } else if (hasWord) {
+                                        globWord(arenaCopy(wordBuffer, wordLength), argc);
+                                        wordLength = 0;
+                                        hasWord = FALSE;
+                                }
+                        }
+                }
+                c = end;
+        }
+        if (argc == NULL)
+                return removeGlobMarks(arenaCopy(wordBuffer, wordLength));
+        if (hasWord)
+                globWord(arenaCopy(wordBuffer, wordLength), argc);
+        return NULL;
+}
+
+const char* variableValue(const char *name, size_t length)//"" when it is not set
+{
+        static char number[16];
+        if (*name == '(')//a command substitution, see appendSubstitution()
+                return commandOutput(name + 1, length - 1);
+        if (length == 1 && *name == '?') {
+                sprintf(number, "%d", lastExitStatus);
+                return number;
+        }
+        if (length == 1 && *name == '$') {
+                sprintf(number, "%d", (int) MSH_PID);
+                return number;
+        }
+        t_variable *variable = findVariable(name, length);
+        return variable->text ? variable->text + length + 1 : "";
+}
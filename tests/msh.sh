@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs command lines through msh -c and holds what they print on stdout and
+# the status they end with against what they should.
+# Run: tests/msh.sh path/to/msh (or make check)
+shell=${1:-build/msh}
+failed=0
+
+check()#line, expected output, expected status
+{
+        output=$("$shell" -c "$1" 2>/dev/null)
+        status=$?
+        if [ "$output" != "$2" ] || [ "$status" != "$3" ]; then
+                printf 'FAIL: %s\n  printed "%s", status %s; wanted "%s", status %s\n' \
+                       "$1" "$output" "$status" "$2" "$3"
+                failed=$((failed + 1))
+        fi
+}
+
+# limit without options is a command named limit, whatever word follows
+check 'limit x=1' '' 127
+check 'limit "a"' '' 127
+check 'limit x=1; echo $x' '' 0
+
+# 127 for no such command, 126 for one that cannot run, 1 for a redirection
+check 'no-such-command-here' '' 127
+check '/no/such/file' '' 127
+check '/etc/passwd' '' 126
+check '/bin/true >&9' '' 1
+
+if [ $failed -gt 0 ]; then
+        echo "$failed failed"
+        exit 1
+fi
+echo "all passed"